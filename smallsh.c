@@ -2,11 +2,15 @@
 * Written by Timothy Trujillo
 * Date: 2/2/2022
 * Assignment 3: Smallsh
-* Program is a custom written shell. Provides a prompt for running commands, allows for comments, expands variable "$$", executes three built-in
-* commands (exit, cd, and status), executes other commands by creating new precesses, supports I/O redirection, supports running commands in 
-* foreground and background processes, and includes custom handlers for SIGINT and SIGSTP.
+* Program is a custom written shell. Provides a prompt for running commands, allows for comments, expands variable "$$" and command
+* substitutions "$(...)", executes the built-in commands exit, cd, status, history, source and timeout, executes other commands by creating new
+* precesses, supports I/O redirection (including >>, N>, N>&M, N<&M, here-documents and here-strings), supports running commands in
+* foreground and background processes, and includes custom handlers for SIGINT and SIGSTP. Commands can be started with launch options
+* (cpus=, nice=, cgroup=, weight= and mem=), the history is kept in a file that can be searched, and ~/.smallshrc is sourced at startup.
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,13 +23,57 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <stdint.h>
+#include <math.h>
+#include <limits.h>
 
 // Define the character that will be used to prompt the user
 #define PROMPT ": "
 
-// Define the maximum length of a command line and the max number of arguments
-#define MAXCOMM 2048
-#define MAXARG 512
+// Define how long background jobs are given to exit after SIGTERM when smallsh exits, in milliseconds. Can be overridden with the
+// SMALLSH_EXIT_GRACE environment variable
+#define EXIT_GRACE_MS 1000
+
+// Define a flag that is added to a wait status when the process was killed by the timeout built-in. It sits above the bits used by wait()
+// so the usual W* macros still work on the status
+#define TIMEDOUT_FLAG 0x10000
+
+// Define where cgroup v2 is mounted. Groups given with the cgroup= launch option are created under smallsh's own cgroup below it, which is
+// the one delegated to the user. Can be overridden with the SMALLSH_CGROUP_ROOT environment variable
+#define CGROUP_MOUNT "/sys/fs/cgroup"
+
+// Define the history file (kept in HOME unless SMALLSH_HISTFILE is set), the value marking the start of each record in it, and the number
+// of buckets in the trigram index used to search it
+#define HISTFILE ".smallsh_history"
+#define HISTORY_MAGIC 0x48534d53
+#define HISTORY_BUCKETS 65536
+
+// Round a length up to a multiple of 8 so records in the history file stay aligned
+#define HISTORY_PAD(n) (((n) + 7) & ~(size_t)7)
+
+// Define the kinds of redirection: '<', '>', '>>', '<&' or '>&', '<<' and '<<<'
+#define REDIR_INPUT 0
+#define REDIR_OUTPUT 1
+#define REDIR_APPEND 2
+#define REDIR_DUP 3
+#define REDIR_HEREDOC 4
+#define REDIR_HERESTRING 5
+
+// Define the startup file that is sourced from HOME, the value marking the start of a parse cache file, and how deeply source can nest
+#define RCFILE ".smallshrc"
+#define CACHE_MAGIC 0x43534d53
+#define CACHE_VERSION 1
+#define MAXSOURCEDEPTH 64
+
+// Define the character left in a command line in place of each command substitution. Its output is only split into words once the line has
+// been tokenised, so it can never be read as a redirection or '&'
+#define SUBST_MARKER '\x01'
 
 // Define variable for monitoring whether or not the process is running in foreground-only mode
 // 
@@ -35,21 +83,131 @@ volatile static sig_atomic_t fgOnly = 0;
 
 /*====================== structs =============================================================================================================================*/
 
+// Define struct for a redirection of one file descriptor. The target is a file name, a file descriptor number (or '-' to close) for
+// REDIR_DUP, or the data itself for here-documents and here-strings
+struct redirect {
+	int type;
+	int fd;
+	char* target;
+};
+
 // Define struct for incoming commands
 struct commandLine {
 	char* command;
-	char* arguments[MAXARG];
-	char* extendArgs[MAXARG + 2];
-	char* redirection[2];
+	char** arguments;
+	char** extendArgs;
+	int numArgs;
+	int capArgs;
+	struct redirect* redirection;
+	int numRedirections;
 	int background;
+	int outputFd;
+	long long timeoutMs;
+	int timeoutSig;
+	cpu_set_t cpus;
+	int hasCpus;
+	int niceValue;
+	int hasNice;
+	char* cgroup;
+	char* cpuWeight;
+	char* memoryMax;
 };
 
 // Define struct for PIDs running in the background
 struct bgPid {
 	int backgroundPid;
+	int timerFd;
+	int timeoutSig;
+	int timedOut;
 	struct bgPid* next;
 };
 
+// Define struct for a buffer that grows geometrically as output is captured into it
+struct growBuf {
+	char* data;
+	size_t len;
+	size_t cap;
+};
+
+// Define struct for the header of a record in the history file. The NUL-terminated command text follows it, padded to 8 bytes
+struct historyRecord {
+	uint32_t magic;
+	uint32_t length;
+	int32_t status;
+	int32_t reserved;
+	int64_t timestamp;
+	int64_t durationMs;
+};
+
+// Define struct for a list of history record numbers that contain a trigram
+struct postingList {
+	uint32_t* ids;
+	uint32_t len;
+	uint32_t cap;
+};
+
+// Define struct for the history file, its memory map and the trigram index built over it
+struct historyLog {
+	int fd;
+	char* map;
+	size_t mapSize;
+	size_t indexedSize;
+	size_t* offsets;
+	size_t numRecords;
+	size_t capRecords;
+	struct postingList* buckets;
+};
+
+// Define variable for the command history. It is shared by the main loop, the history built-in and command substitution
+static struct historyLog historyLog = { -1 };
+
+// Define struct for the header of a parsed script. The script's path follows it, then its commands, each either a raw line that still needs
+// to be expanded or an already parsed command. The same form is kept in memory and written to the cache directory
+struct scriptHeader {
+	uint32_t magic;
+	uint32_t version;
+	int64_t mtimeSec;
+	int64_t mtimeNsec;
+	int64_t size;
+	uint32_t pathLength;
+	uint32_t reserved;
+};
+
+// Define struct for reading through a parsed script
+struct scriptReader {
+	char* data;
+	size_t len;
+	size_t pos;
+	int failed;
+};
+
+// Define struct for a parsed script. It is counted by the cache and by every run of it in progress, so a nested source that replaces the
+// cached copy does not free one that is still being read
+struct scriptBlob {
+	struct growBuf buf;
+	int refs;
+};
+
+// Define struct for parsed scripts kept in memory so sourcing a script again skips parsing it
+struct scriptCache {
+	char* path;
+	struct scriptBlob* blob;
+	struct scriptCache* next;
+};
+
+// Define variables for the scripts parsed so far and the script the source built-in is reading lines from. Here-documents in a script
+// read their lines from it instead of stdin
+static struct scriptCache* scriptCaches = NULL;
+static FILE* scriptInput = NULL;
+
+// Define variable for the directory that cgroup= groups are created in. It is found the first time a command asks for a cgroup
+static char* cgroupBase = NULL;
+
+// Define variables for input that has been read from stdin but not used yet. stdin is read in chunks instead of through stdio so the shell
+// knows when a line is already waiting and only needs to poll() when it is not
+static struct growBuf inputBuf = { NULL, 0, 0 };
+static size_t inputPos = 0;
+
 /*====================== sigaction functions ====================================================================================================================*/
 
 /*
@@ -193,601 +351,2984 @@ void changeSIGTSTP(void) {
 /*====================== functions ===========================================================================================================================*/
 
 /*
-* Prompt user to enter a command. User takes a pointer to memory for storing the user's inpu. Returns 1 if the user enters a command and 0 if the 
-* user enters a comment or a blank command.
+* Make sure a growable buffer has room for at least extra more bytes. The capacity is doubled until it fits so that appending n bytes
+* costs amortized O(n). Takes in the buffer and the number of bytes needed. Exits the shell if memory cannot be allocated.
 */
-int promptUser(char *commandLine) {
-	int hasChars = 0;
-	int i;
-
-	//Initialize commandLine prompt with all null characters
-	memset(commandLine, '\0', MAXCOMM);
-	
-	// Prompt the user for a command
-	printf("%s", PROMPT);
-	fflush(stdout);
-
-	// Get the command from the user
-	fgets(commandLine, MAXCOMM, stdin);
-
-	// Check to see if an argument of all spaces or a comment has been entered
-	for (i = 0; i < strlen(commandLine); i++) {
-		if (commandLine[i] == '#') {
-			return 0;
-		}
+void growBufReserve(struct growBuf* buf, size_t extra) {
 
-		// Check to all empty spaces were entered
-		else if (commandLine[i] != ' ' && commandLine[i] != '\0' && commandLine[i] != '\n') {
-			hasChars = 1;
-			break;
-		}
+	if (buf->len + extra <= buf->cap) {
+		return;
 	}
 
-	// Return 0 if the user entered a comment or a blank command
-	if (commandLine[0] == '#' || commandLine[0] == '\0' || commandLine[0] == '\n' || hasChars == 0) {
-		return 0;
+	size_t newCap = buf->cap == 0 ? 4096 : buf->cap;
+	while (newCap < buf->len + extra) {
+		newCap *= 2;
 	}
-	
-	// Return 1 if the user entered a command
-	else {
-		return 1;
+
+	buf->data = realloc(buf->data, newCap);
+	if (buf->data == NULL) {
+		perror("realloc()");
+		exit(1);
 	}
+	buf->cap = newCap;
 }
 
 /*
-* Find any instance of '$$' in the command and expand it into the process ID of the smallsh. Takes in the command string and performs expansion in place
+* Append text to the end of a growable buffer and keep it NUL-terminated. Takes in the buffer, the text and its length.
 */
-void varExpansion(char* commandLine) {
-	
-	// Get the PID of smallsh and convert it into a string
-	int smallshPid = getpid();
-	char smallshPidStr[7];
-	sprintf(smallshPidStr, "%d", smallshPid);
-	
-	// Create a temporary placeholder for building the command with '$$' variable expanded 
-	char* tempPlaceholder = malloc(sizeof(char) * MAXCOMM);
-	memset(tempPlaceholder, '\0', sizeof(char) * MAXCOMM);
-	
-	int i;
-	int j = 0;
+void growBufAppend(struct growBuf* buf, char* text, size_t length) {
+
+	growBufReserve(buf, length + 1);
+	memcpy(buf->data + buf->len, text, length);
+	buf->len += length;
+	buf->data[buf->len] = '\0';
+}
+
+/*
+* Read everything from a file descriptor until end of file. Data is read straight into the free space at the end of the buffer so no
+* intermediate copies are made. Takes in the file descriptor and the buffer to append to.
+*/
+void readAllFd(int fd, struct growBuf* buf) {
 
-	// Create a null-terminated string that can be used to strcat individual characters
-	char nextChar[2];
-	memset(nextChar, '\0', 2);
+	ssize_t bytesRead;
 
-	// Iterate through the command and look for instances of '$$'
-	for (i = 1; i < strlen(commandLine)+1; i++) {
+	while (1) {
+		growBufReserve(buf, 4096);
+		bytesRead = read(fd, buf->data + buf->len, buf->cap - buf->len);
 
-		// If '$$' is found, append the PID to the placeholder string and set the '$$' instance to '##'. 
-		// This will show that these characters have already been used for expansion.
-		if (commandLine[i] == '$' && commandLine[j] == '$') {
-			strcat(tempPlaceholder, smallshPidStr);
-			commandLine[i] = '#';
-			commandLine[j] = '#';
-			i++;
-			j++;
+		if (bytesRead > 0) {
+			buf->len += bytesRead;
+		}
+		else if (bytesRead == -1 && errno == EINTR) {
+			continue;
 		}
-
-		// Otherwise, append the character to the temp string
 		else {
-			nextChar[0] = commandLine[j];
-			strcat(tempPlaceholder, nextChar);
+			break;
 		}
-		j++;
 	}
+}
 
-	// Copy the temp string with variables expanded over to the commandLine string.
-	strcpy(commandLine, tempPlaceholder);
-
-	free(tempPlaceholder);
+/*
+* Get the current time from the monotonic clock in milliseconds. Used for measuring timeouts that should not be affected by changes to the wall clock.
+*/
+long long monotonicMs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
 }
 
 /*
-* Process the command entered by the user. Takes in the string entered by the user and divides it into the command, arguments, redirection (if applicable)
-* and whether or not the process should be sent to the background.
+* Move a file descriptor that smallsh keeps for itself to 10 or above, out of the range users can name in redirections such as '0<&3', so a
+* command can never be handed one of them. The new descriptor is close-on-exec. Takes in the file descriptor and returns the new one, or the
+* one given if it could not be moved.
 */
-struct commandLine* processComm(char* commandLine){
-	struct commandLine* currCommand = malloc(sizeof(struct commandLine));
+int moveFdHigh(int fd) {
 
-	int i;
-	int j = 0;
+	if (fd == -1) {
+		return -1;
+	}
+
+	int highFd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+	if (highFd == -1) {
+		return fd;
+	}
 
-	// Keep track of index within currCommand->arguments and currCommand->redirection so that new elements can be added to the proper locations
-	int iArguments = 0;
-	int iRedirections = 0;
-	int iExtendArgs = 0;
+	close(fd);
+	return highFd;
+}
+
+/*
+* Open a pidfd for a child process so its exit can be waited on with poll(). Takes in the pid and returns the pidfd, or -1 if pidfds are not supported.
+*/
+int openPidfd(pid_t pid) {
+	return moveFdHigh(syscall(SYS_pidfd_open, pid, 0));
+}
 
-	// Set both redirection options to null
-	currCommand->redirection[0] = '\0';
-	currCommand->redirection[1] = '\0';
+/*
+* Send a command the signal for its timeout, to its whole process group if it has one. A command stopped by the signal is sent SIGCONT as
+* well, the same as coreutils timeout does, so that it can act on the signal and be waited for. Takes in the pid and the signal.
+*/
+void sendTimeout(pid_t pid, int sig) {
 
-	// Initialize the arguments array with null values
-	for (i = 0; i < MAXARG; i++) {
-		currCommand->arguments[i] = '\0';
+	if (kill(-pid, sig) == -1) {
+		kill(pid, sig);
 	}
 
-	// Initialize the extendArgs array with null values
-	for (i = 0; i < MAXARG+2; i++) {
-		currCommand->extendArgs[i] = '\0';
+	if (sig != SIGKILL && sig != SIGCONT && kill(-pid, SIGCONT) == -1) {
+		kill(pid, SIGCONT);
 	}
+}
+
+/*
+* Event loop for the timeouts of background jobs. Every background job started with the timeout built-in has a timerfd, and all of them are
+* polled in the same poll() as whatever the shell is waiting on, such as stdin at the prompt or a foreground command's pidfd, so timeouts
+* fire on time whatever the shell is doing. When a timer expires, the job's process group is sent its timeout signal. Takes in the list of
+* background processes, the file descriptors to wait on and how many there are, and the poll() timeout in milliseconds. Returns how many of
+* those file descriptors are ready, or -1 if poll() failed.
+*/
+int checkBgTimers(struct bgPid* bgList, struct pollfd* waitFds, int numWait, int timeout) {
+
+	struct bgPid* node;
+	int numTimers = 0;
+	int ready;
+	int i;
 
-	// Add a special delimiter temporarily between redirectors and files. This will allow strtok_r to use spaces as delimiters.
-	for (i = 1; i < strlen(commandLine); i++) {
-		if (commandLine[j] == '<' || commandLine[j] == '>') {
-			commandLine[i] = ';';
+	for (node = bgList; node != NULL; node = node->next) {
+		if (node->backgroundPid != '\0' && node->timerFd != -1) {
+			numTimers++;
 		}
-		j++;
 	}
 
-	// Check to see if the input end with an ampersand. If so, change currCommand->background to 1 indicating the command should
-	// be run in the background.
-	if (commandLine[strlen(commandLine) - 2] == '&' && commandLine[strlen(commandLine) - 3] == ' ') {
-		currCommand->background = 1;
-		commandLine[strlen(commandLine) - 2] = '\0';
-	}
-	else {
-		currCommand->background = 0;
+	if (numTimers == 0 && numWait == 0) {
+		return 0;
 	}
 
-	// For maintaining context between srttok calls
-	char* saveptr;
+	// The first slots hold the file descriptors being waited on, the rest hold the timers
+	struct pollfd* fds = calloc(numWait + numTimers, sizeof(struct pollfd));
+	struct bgPid** nodes = calloc(numWait + numTimers, sizeof(struct bgPid*));
 
-	// First token is the command
-	char* token = strtok_r(commandLine, " ,'\n'", &saveptr);
-	currCommand->command = calloc(strlen(token) + 1, sizeof(char));
-	currCommand->extendArgs[iExtendArgs] = calloc(strlen(token) + 1, sizeof(char));
-	strcpy(currCommand->command, token);
+	memcpy(fds, waitFds, numWait * sizeof(struct pollfd));
 
-	// // Add the command to the extended arguments array that will be used to pass the arguments list to execvp()
-	strcpy(currCommand->extendArgs[iExtendArgs], token);
-	iExtendArgs += 1;
+	i = numWait;
+	for (node = bgList; node != NULL; node = node->next) {
+		if (node->backgroundPid != '\0' && node->timerFd != -1) {
+			fds[i].fd = node->timerFd;
+			fds[i].events = POLLIN;
+			nodes[i] = node;
+			i++;
+		}
+	}
 
-	token = strtok_r(NULL, " ,'\n'", &saveptr);
+	ready = poll(fds, numWait + numTimers, timeout);
 
-	// Process the arguments and redirections if applicable
-	while (token != NULL) {
+	if (ready != -1) {
 
-		// Check if the token is a redirection
-		if (token[0] == '<' || token[0] == '>') {
-			token[1] = ' ';
-			currCommand->redirection[iRedirections] = calloc(strlen(token) + 1, sizeof(char));
-			strcpy(currCommand->redirection[iRedirections], token);
-			iRedirections += 1;
+		// Send the timeout signal to every job whose timer has expired
+		for (i = numWait; i < numWait + numTimers; i++) {
+			if (fds[i].revents & POLLIN) {
+				sendTimeout(nodes[i]->backgroundPid, nodes[i]->timeoutSig);
+				nodes[i]->timedOut = 1;
+				close(nodes[i]->timerFd);
+				nodes[i]->timerFd = -1;
+				ready--;
+			}
 		}
 
-		// Otherwise, it will be categorized as an argument
-		else {
-			currCommand->arguments[iArguments] = calloc(strlen(token) + 1, sizeof(char));
-			currCommand->extendArgs[iExtendArgs] = calloc(strlen(token) + 1, sizeof(char));
-			strcpy(currCommand->arguments[iArguments], token);
-
-			// Add the argument to the extended arguments array that will be used to pass the arguments list to execvp()
-			strcpy(currCommand->extendArgs[iExtendArgs], token);
-			iArguments += 1;
-			iExtendArgs += 1;
+		for (i = 0; i < numWait; i++) {
+			waitFds[i].revents = fds[i].revents;
 		}
-		token = strtok_r(NULL, " ,'\n'", &saveptr);
 	}
 
-	// Add NULL as the last element of the extendedArgs array
-	currCommand->extendArgs[iExtendArgs] = NULL;
+	free(fds);
+	free(nodes);
 
-	return currCommand;
+	return ready;
 }
 
 /*
-* Function performs cleanup before exiting the program. Takes in the list of background processes and kills them all. It then returns 0 to main which
-* causes the loop to exit and terminates the program.
+* Read a line from stdin, the way getline() does. Input is read from file descriptor 0 in chunks into inputBuf. Only when no complete line
+* is buffered does the shell wait for more, polling stdin together with the timers of the background jobs. Takes in pointers to the line
+* buffer and its size, which are grown to fit the line, and the list of background processes. Returns the length of the line, or -1 at the
+* end of input.
 */
-int exitCheck(struct bgPid* bgList) {
-	
-	while (bgList != NULL) {
-		if (bgList->backgroundPid != '\0') {
-			kill(bgList->backgroundPid, SIGKILL);
+ssize_t readInputLine(char** linePtr, size_t* lineSize, struct bgPid* bgList) {
+
+	struct pollfd input = { 0, POLLIN, 0 };
+	char* newline = NULL;
+	ssize_t bytesRead;
+	size_t length;
+	int ready;
+
+	while (inputPos == inputBuf.len || (newline = memchr(inputBuf.data + inputPos, '\n', inputBuf.len - inputPos)) == NULL) {
+
+		// Move the start of a partial line to the front so the buffer only grows for long lines
+		if (inputPos > 0) {
+			memmove(inputBuf.data, inputBuf.data + inputPos, inputBuf.len - inputPos);
+			inputBuf.len -= inputPos;
+			inputPos = 0;
 		}
 
-		bgList = bgList->next;
+		// Signals such as SIGTSTP interrupt the wait
+		do {
+			ready = checkBgTimers(bgList, &input, 1, -1);
+		} while (ready == 0 || (ready == -1 && errno == EINTR));
+
+		growBufReserve(&inputBuf, 4096);
+		bytesRead = read(0, inputBuf.data + inputBuf.len, inputBuf.cap - inputBuf.len);
+		if (bytesRead == -1 && errno == EINTR) {
+			continue;
+		}
+
+		// At the end of input, the last line may not have a newline
+		if (bytesRead <= 0) {
+			if (inputBuf.len == 0) {
+				return -1;
+			}
+			break;
+		}
+		inputBuf.len += bytesRead;
 	}
 
-	// Return 0 to the runSmallsh variable in main which will cause the shell to terminate
-	return 0;
+	length = (newline != NULL) ? newline - (inputBuf.data + inputPos) + 1 : inputBuf.len - inputPos;
+
+	if (*linePtr == NULL || *lineSize < length + 1) {
+		*lineSize = length + 1;
+		*linePtr = realloc(*linePtr, *lineSize);
+	}
+	memcpy(*linePtr, inputBuf.data + inputPos, length);
+	(*linePtr)[length] = '\0';
+	inputPos += length;
 
+	return length;
 }
 
 /*
-* Function changes the working directory of smallsh. If there are no arguments, the directory will be changed to the one
-* specified in the HOME environment variable. This function can also process a single argument which is the (relative or absolute)
-* path of a directory to change to. This function takes in the current command as an argument
-* 
-* Citation: Adapted from Module 4 - Processes; Exploration: Environment; Example 
-*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-environment?module_item_id=21835975
+* Give back input that has been read ahead but not used yet, so a command that reads stdin starts where the shell stopped. This can only be
+* done when stdin is a file, since input from a pipe or terminal cannot be read again. Run before forking a command.
 */
-void changeDir(struct commandLine* currCommand) {
-
-	// If no argument is passed, set the current working directory to HOME
-	if (currCommand->arguments[0] == NULL) {
-		chdir(getenv("HOME"));
-
-	}
-	// If an argument is passed, change the current working directory to the path in the argument
-	else {
-		chdir(currCommand->arguments[0]);
+void unreadInput(void) {
 
+	if (inputPos < inputBuf.len && lseek(0, -(off_t)(inputBuf.len - inputPos), SEEK_CUR) != -1) {
+		inputBuf.len = 0;
+		inputPos = 0;
 	}
 }
 
 /*
-* Function checks the exit status or termination signal of the last foreground process run by the shell. Takes in the 
-* exitStatus variable.
-* 
-* Citation: Adapted from Module 4 - Processes; Exploration: Process API - Monitoring Child Processes; Example in Interpreting the Termination Status section
-*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-process-api-monitoring-child-processes?module_item_id=21835973
+* Check whether a line holds a command. Takes in the line and returns 1 if it does, or 0 if it is a comment or blank.
 */
-void checkStatus(int exitStatus) {
-
-	// Variable used for printing exit status/signal
-	int pExitStatus;
+int hasCommand(char* commandLine) {
+	int hasChars = 0;
+	int i;
 
-	// Checks to see if the process terminated normally
-	if (WIFEXITED(exitStatus) != 0) {
+	// Check to see if an argument of all spaces or a comment has been entered
+	for (i = 0; i < strlen(commandLine); i++) {
+		if (commandLine[i] == '#') {
+			return 0;
+		}
 
-		// If the process terminated normally, get the exit status value
-		pExitStatus = WEXITSTATUS(exitStatus);
-		printf("exit value %d\n", pExitStatus);
-		fflush(stdout);
+		// Check to all empty spaces were entered
+		else if (commandLine[i] != ' ' && commandLine[i] != '\0' && commandLine[i] != '\n') {
+			hasChars = 1;
+			break;
+		}
 	}
 
-	// Otherwise, the process terminated abnormally
-	else if (WIFSIGNALED(exitStatus) != 0) {
-
-		// Get the signal number that caused the child to terminate abnormally
-		pExitStatus = WTERMSIG(exitStatus);
-		printf("terminated by signal %d\n", pExitStatus);
-		fflush(stdout);
+	// Return 0 if the user entered a comment or a blank command
+	if (commandLine[0] == '#' || commandLine[0] == '\0' || commandLine[0] == '\n' || hasChars == 0) {
+		return 0;
 	}
+	
+	// Return 1 if the user entered a command
 	else {
-		printf("%d\n", 0);
-		fflush(stdout);
+		return 1;
 	}
 }
 
 /*
-* Preprocess redirection: Open files necessary for the redirections.
-* 
-* Citation: Adapted from Module 5 - Processes II; Exploration: Processes and I/O; Example: Redirecting both Stdin and Stdout
-*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-processes-and-i-slash-o?module_item_id=21835982
+* Prompt user to enter a command. User takes a pointer that is set to newly allocated memory holding the user's input, which can be any
+* length, and the list of background processes, whose timeouts are serviced while waiting for input. Returns 1 if the user enters a command
+* and 0 if the user enters a comment or a blank command.
+*/
+int promptUser(char** commandLinePtr, struct bgPid* bgList) {
+	char* commandLine = NULL;
+	size_t lineSize = 0;
+	
+	// Prompt the user for a command
+	printf("%s", PROMPT);
+	fflush(stdout);
+
+	// Get the command from the user, handling background timeouts while waiting. The buffer grows to fit the whole line
+	if (readInputLine(&commandLine, &lineSize, bgList) == -1) {
+		free(commandLine);
+		commandLine = calloc(1, sizeof(char));
+	}
+	*commandLinePtr = commandLine;
+
+	return hasCommand(commandLine);
+}
+
+/*
+* Find any instance of '$$' in the command and expand it into the process ID of the smallsh. Takes in a pointer to the command string, which is
+* replaced with a newly allocated string if anything is expanded.
 */
-void procRedirect(struct commandLine* currCommand, int index) {
+void varExpansion(char** commandLinePtr) {
 
-	int redirectFrom;
-	int redirectTo;
-	int result;
+	char* commandLine = *commandLinePtr;
 
-	// For maintaining context between srttok calls
-	char* saveptr;
+	// Get the PID of smallsh and convert it into a string
+	int smallshPid = getpid();
+	char smallshPidStr[12];
+	sprintf(smallshPidStr, "%d", smallshPid);
+	size_t pidLength = strlen(smallshPidStr);
 
-	// First token is the direction of the redirect
-	char* token = strtok_r(currCommand->redirection[index], " ", &saveptr);
+	size_t i;
+	size_t j = 0;
+	size_t count = 0;
 
-	if (token[0] == '<') {
-		token = strtok_r(NULL, " , '\n'", &saveptr);
-		
-		// Open file that will be the source
-		redirectFrom = open(token, O_RDONLY);
-		if (redirectFrom == -1) {
-			printf("cannot open %s for input\n", token);
-			exit(1);
+	// Count the instances of '$$' so the expanded command can be allocated at its full size
+	for (i = 0; commandLine[i] != '\0'; i++) {
+		if (commandLine[i] == '$' && commandLine[i + 1] == '$') {
+			count++;
+			i++;
 		}
+	}
 
-		// Redirect stdin to the source file
-		result = dup2(redirectFrom, 0);
-		if (result == -1) {
-			printf("source redirection failed");
-			exit(2);
-		}
+	if (count == 0) {
+		return;
 	}
-	else {
-		token = strtok_r(NULL, " , '\n'", &saveptr);
 
-		// Open file that will be the destination
-		redirectTo = open(token, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-		if (redirectTo == -1) {
-			printf("cannot open %s for output\n", token);
-			exit(1);
-		}
+	// Create a placeholder for building the command with '$$' variable expanded
+	char* tempPlaceholder = malloc(strlen(commandLine) + count * pidLength + 1);
 
-		// Redirect stdout to the destination file
-		result = dup2(redirectTo, 1);
-		if (result == -1) {
-			printf("target redirection failed");
-			exit(2);
+	// Copy the command over, appending the PID in place of each '$$'
+	for (i = 0; commandLine[i] != '\0'; i++) {
+		if (commandLine[i] == '$' && commandLine[i + 1] == '$') {
+			memcpy(tempPlaceholder + j, smallshPidStr, pidLength);
+			j += pidLength;
+			i++;
+		}
+		else {
+			tempPlaceholder[j++] = commandLine[i];
 		}
 	}
+	tempPlaceholder[j] = '\0';
+
+	// Replace the command line with the expanded one
+	free(commandLine);
+	*commandLinePtr = tempPlaceholder;
 }
 
 /*
-* Function performs default redirection for background processes. Will use dev/null for both input and output. Will be run before any 
-* redirection specified in the command so that it can be overwritten if necessary. Takes in the current command as an argument.
-* 
-* Citation: Adapted from Module 5 - Processes II; Exploration: Processes and I/O; Example: Redirecting both Stdin and Stdout
-*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-processes-and-i-slash-o?module_item_id=21835982
+* Collect the data for a here-document ('<<DELIM') or here-string ('<<< word'). A here-string uses the word followed by a newline. A here-document
+* reads the lines that follow from stdin (or the script being sourced) until a line matching the delimiter is found. Takes in the redirection, whose target is the delimiter
+* or word, and replaces the target with a newly allocated copy of the data.
 */
-void bgRedirect(struct commandLine* currCommand) {
-	// Open file that will be the source
-	int redirectFrom = open("/dev/null", O_RDONLY);
-	if (redirectFrom == -1) {
-		printf("source open failed");
-		exit(1);
+void hereDocument(struct redirect* redirection) {
+
+	struct growBuf data = { NULL, 0, 0 };
+	char* word = redirection->target;
+	char* line = NULL;
+	size_t lineSize = 0;
+	ssize_t lineLen;
+	size_t length = strlen(word);
+
+	// Here-string: the word is the data
+	if (redirection->type == REDIR_HERESTRING) {
+		growBufReserve(&data, length + 1);
+		memcpy(data.data, word, length);
+		data.len = length;
+		data.data[data.len++] = '\n';
 	}
 
-	// Redirect stdin to the source file
-	int result = dup2(redirectFrom, 0);
-	if (result == -1) {
-		printf("source dup failed");
-		exit(2);
-	}
+	// Here-document: read lines until the delimiter is found on a line by itself. Inside a sourced script the lines come from the script
+	else {
+		while (1) {
+			if (scriptInput == NULL) {
+				printf("> ");
+				fflush(stdout);
+			}
 
-	// Open file that will be the destination
-	int redirectTo = open("/dev/null", O_WRONLY);
-	if (redirectTo == -1) {
-		printf("target open failed");
-		exit(1);
-	}
+			lineLen = (scriptInput != NULL) ? getline(&line, &lineSize, scriptInput) : readInputLine(&line, &lineSize, NULL);
+			if (lineLen == -1) {
+				break;
+			}
+			if (lineLen == length + 1 && strncmp(line, word, length) == 0 && line[length] == '\n') {
+				break;
+			}
 
-	// Redirect stdout to the destination file
-	result = dup2(redirectTo, 1);
-	if (result == -1) {
-		printf("target dup2 failed");
-		exit(2);
+			growBufReserve(&data, lineLen);
+			memcpy(data.data + data.len, line, lineLen);
+			data.len += lineLen;
+		}
+		free(line);
 	}
+
+	growBufReserve(&data, 1);
+	data.data[data.len] = '\0';
+
+	redirection->target = data.data;
 }
 
 /*
-* Function adds pid to the list of jobs running in the background so that periodic checks can be done on completed
-* background jobs. Function takes in the pid that needs to be added along with the head of the list. 
+* Check whether a word is a redirection such as '<', '>>', '2>', '2>&1', '0<&3' or '<<<'. A number before the operator picks the file descriptor
+* to redirect, otherwise it is stdin for '<' operators and stdout for '>' operators. Takes in the word and the redirection to fill in. Returns
+* a pointer to the text after the operator (which is empty if the target is the next word), or NULL if the word is not a redirection.
 */
-void addToBgList(int spawnpid, struct bgPid* bgList) {
+char* parseRedirect(char* token, struct redirect* redirection) {
 
-	// Iterate through the linked list to add the child pid to the first available node
-	while (bgList != NULL) {
+	char* operators[] = { "<<<", "<<", "<&", ">&", ">>", "<", ">" };
+	int types[] = { REDIR_HERESTRING, REDIR_HEREDOC, REDIR_DUP, REDIR_DUP, REDIR_APPEND, REDIR_INPUT, REDIR_OUTPUT };
+	char* operator = token + strspn(token, "0123456789");
+	int i;
 
-		// If an empty node is found, add the child pid to the node and exit the loop
-		if (bgList->backgroundPid == '\0') {
-			bgList->backgroundPid = spawnpid;
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (strncmp(operator, operators[i], strlen(operators[i])) == 0) {
+			redirection->type = types[i];
+			redirection->fd = (operator != token) ? atoi(token) : (operators[i][0] == '<') ? 0 : 1;
+			redirection->target = NULL;
+			return operator + strlen(operators[i]);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+* Add a word to the end of a command's argument arrays. Both arrays double in size when they fill up, so a command can have any number of
+* arguments. The word is copied once and the copy is shared by both arrays, since the arguments array is the extended one without the
+* command. Takes in the command and the word.
+*/
+void addArgument(struct commandLine* currCommand, char* token) {
+
+	// Leave room for the NULL that ends each array
+	if (currCommand->numArgs + 1 >= currCommand->capArgs) {
+		currCommand->capArgs *= 2;
+		currCommand->arguments = realloc(currCommand->arguments, currCommand->capArgs * sizeof(char*));
+		currCommand->extendArgs = realloc(currCommand->extendArgs, currCommand->capArgs * sizeof(char*));
+	}
+
+	// Add the word to the extended arguments array that will be used to pass the arguments list to execvp()
+	currCommand->extendArgs[currCommand->numArgs] = strdup(token);
+
+	// Every word after the command is also an argument
+	if (currCommand->numArgs > 0) {
+		currCommand->arguments[currCommand->numArgs - 1] = currCommand->extendArgs[currCommand->numArgs];
+	}
+
+	currCommand->numArgs += 1;
+	currCommand->extendArgs[currCommand->numArgs] = NULL;
+	currCommand->arguments[currCommand->numArgs - 1] = NULL;
+}
+
+/*
+* Create an empty command with every option set to its default. Returns the new command.
+*/
+struct commandLine* newCommand(void) {
+	struct commandLine* currCommand = malloc(sizeof(struct commandLine));
+
+	// Start with no redirections
+	currCommand->redirection = NULL;
+	currCommand->numRedirections = 0;
+
+	// Output goes to the terminal unless the command is being captured for command substitution
+	currCommand->outputFd = -1;
+
+	// Commands have no time limit unless they are run with the timeout built-in
+	currCommand->timeoutMs = 0;
+	currCommand->timeoutSig = SIGTERM;
+
+	// Commands run with the shell's CPUs, priority and cgroup unless launch options are given
+	currCommand->hasCpus = 0;
+	currCommand->hasNice = 0;
+	currCommand->cgroup = NULL;
+	currCommand->cpuWeight = NULL;
+	currCommand->memoryMax = NULL;
+
+	// Start with empty argument arrays. They grow as words are added
+	currCommand->numArgs = 0;
+	currCommand->capArgs = 8;
+	currCommand->arguments = calloc(currCommand->capArgs, sizeof(char*));
+	currCommand->extendArgs = calloc(currCommand->capArgs, sizeof(char*));
+
+	currCommand->command = NULL;
+	currCommand->background = 0;
+
+	return currCommand;
+}
+
+/*
+* Add a word produced by a command substitution to the command's arguments, or to the end of the joined words when expanding a redirection
+* target. Takes in the command, the word and the buffer of joined words, or NULL to add the word as an argument.
+*/
+void addExpandedWord(struct commandLine* currCommand, char* word, struct growBuf* joined) {
+
+	if (joined == NULL) {
+		addArgument(currCommand, word);
+		return;
+	}
+	if (joined->len > 0) {
+		growBufAppend(joined, " ", 1);
+	}
+	growBufAppend(joined, word, strlen(word));
+}
+
+/*
+* Expand a word holding command substitution markers. The output of each substitution is split on whitespace, with its first word joined to
+* the text before the marker and its last word joined to the text after it. Words are cut out of the outputs in place by ending them with a
+* NUL, so only words joined to text around a marker are built up in a separate buffer. The words are added straight to the command's
+* arguments, or joined with spaces when the word is a redirection target. Takes in the command, the word, the outputs of the substitutions,
+* the position of the next output in them and the buffer for the joined words, or NULL to add them as arguments.
+*/
+void expandWord(struct commandLine* currCommand, char* token, struct growBuf* substOutput, size_t* substPos, struct growBuf* joined) {
+
+	struct growBuf word = { NULL, 0, 0 };
+	char* marker;
+	char* output;
+	size_t length;
+
+	while (1) {
+
+		// Text outside of the substitutions is kept as it is
+		marker = strchr(token, SUBST_MARKER);
+		length = (marker != NULL) ? (size_t)(marker - token) : strlen(token);
+		if (length > 0) {
+			growBufAppend(&word, token, length);
+		}
+		if (marker == NULL) {
+			break;
+		}
+		token = marker + 1;
+
+		// Take the next output for the marker
+		output = "";
+		if (substOutput != NULL && *substPos < substOutput->len) {
+			output = substOutput->data + *substPos;
+			*substPos += strlen(output) + 1;
+		}
+
+		// Whitespace in the output ends the current word. A word with nothing joined to it is used where it is in the output
+		length = strcspn(output, " \t\n");
+		while (output[length] != '\0') {
+			output[length] = '\0';
+			if (word.len > 0) {
+				growBufAppend(&word, output, length);
+				addExpandedWord(currCommand, word.data, joined);
+				word.len = 0;
+			}
+			else if (length > 0) {
+				addExpandedWord(currCommand, output, joined);
+			}
+			output += length + 1;
+			length = strcspn(output, " \t\n");
+		}
+
+		// The last word of the output continues into the text after the marker, if there is any
+		if (word.len == 0 && *token == '\0') {
+			if (length > 0) {
+				addExpandedWord(currCommand, output, joined);
+			}
+		}
+		else if (length > 0) {
+			growBufAppend(&word, output, length);
+		}
+	}
+
+	if (word.len > 0) {
+		addExpandedWord(currCommand, word.data, joined);
+	}
+	free(word.data);
+}
+
+/*
+* Process the command entered by the user. Takes in the string entered by the user and divides it into the command, arguments, redirection (if applicable)
+* and whether or not the process should be sent to the background. Also takes in the outputs of any command substitutions in the line, or NULL
+* if there are none.
+*/
+struct commandLine* processComm(char* commandLine, struct growBuf* substOutput){
+	struct commandLine* currCommand = newCommand();
+
+	size_t length = strlen(commandLine);
+
+	struct redirect redirection;
+	struct growBuf joinedTarget;
+	char* target;
+
+	// Check to see if the input end with an ampersand. If so, change currCommand->background to 1 indicating the command should
+	// be run in the background.
+	if (length >= 3 && commandLine[length - 2] == '&' && commandLine[length - 3] == ' ') {
+		currCommand->background = 1;
+		commandLine[length - 2] = '\0';
+	}
+	else {
+		currCommand->background = 0;
+	}
+
+	// For maintaining context between srttok calls
+	char* saveptr;
+
+	// Position of the next output in substOutput
+	size_t substPos = 0;
+
+	char* token = strtok_r(commandLine, " ,'\n'", &saveptr);
+
+	// Process the command, arguments and redirections if applicable
+	while (token != NULL) {
+
+		// Check if the token is a redirection
+		if ((target = parseRedirect(token, &redirection)) != NULL) {
+
+			// The target can follow the operator directly or be the next word. It is left NULL if it is missing
+			if (*target == '\0') {
+				target = strtok_r(NULL, " ,'\n'", &saveptr);
+			}
+			// A target that expands to nothing is left missing
+			if (target != NULL && strchr(target, SUBST_MARKER) != NULL) {
+				joinedTarget = (struct growBuf){ NULL, 0, 0 };
+				expandWord(currCommand, target, substOutput, &substPos, &joinedTarget);
+				redirection.target = joinedTarget.data;
+			}
+			else if (target != NULL) {
+				redirection.target = calloc(strlen(target) + 1, sizeof(char));
+				strcpy(redirection.target, target);
+			}
+
+			// Here-documents and here-strings carry their data in place of a file name
+			if (redirection.target != NULL && (redirection.type == REDIR_HEREDOC || redirection.type == REDIR_HERESTRING)) {
+				target = redirection.target;
+				hereDocument(&redirection);
+				free(target);
+			}
+
+			// Add the redirection to the end of the list so they are applied in the order they were given
+			currCommand->redirection = realloc(currCommand->redirection, (currCommand->numRedirections + 1) * sizeof(struct redirect));
+			currCommand->redirection[currCommand->numRedirections] = redirection;
+			currCommand->numRedirections += 1;
+		}
+
+		// Words holding a command substitution are replaced by the words of its output
+		else if (strchr(token, SUBST_MARKER) != NULL) {
+			expandWord(currCommand, token, substOutput, &substPos, NULL);
+		}
+
+		// Otherwise, it will be categorized as an argument
+		else {
+			addArgument(currCommand, token);
+		}
+		token = strtok_r(NULL, " ,'\n'", &saveptr);
+	}
+
+	// The first word is the command. A line left with no words, such as one whose substitutions printed nothing, runs an empty command
+	// that fails like any other that cannot be found
+	if (currCommand->numArgs == 0) {
+		addArgument(currCommand, "");
+	}
+	currCommand->command = calloc(strlen(currCommand->extendArgs[0]) + 1, sizeof(char));
+	strcpy(currCommand->command, currCommand->extendArgs[0]);
+
+	return currCommand;
+}
+
+/*
+* Function performs cleanup before exiting the program. Takes in the list of background processes and shuts them all down in parallel: every
+* job's process group is sent SIGTERM at once, then all of them are waited on together through pidfds in a single poll(). Jobs still running
+* once the grace period is up are sent SIGKILL. Exiting never takes much longer than the grace period no matter how many jobs are running.
+* It then returns 0 to main which causes the loop to exit and terminates the program.
+*/
+int exitCheck(struct bgPid* bgList) {
+
+	struct bgPid* node;
+	int numJobs = 0;
+	int remaining;
+	int exited = 0;
+	int killed = 0;
+	int childStatus;
+	int i;
+
+	// Count the jobs that are still running
+	for (node = bgList; node != NULL; node = node->next) {
+		if (node->backgroundPid != '\0') {
+			numJobs++;
+		}
+	}
+
+	if (numJobs == 0) {
+		return 0;
+	}
+
+	// Get the grace period jobs are given to clean up before they are killed
+	long long graceMs = EXIT_GRACE_MS;
+	if (getenv("SMALLSH_EXIT_GRACE") != NULL) {
+		graceMs = atoll(getenv("SMALLSH_EXIT_GRACE"));
+	}
+
+	pid_t* pids = calloc(numJobs, sizeof(pid_t));
+	struct pollfd* pidfds = calloc(numJobs, sizeof(struct pollfd));
+	int allPidfds = 1;
+
+	// Ask every job to terminate at once. Background jobs lead their own process group so the whole group is signalled
+	i = 0;
+	for (node = bgList; node != NULL; node = node->next) {
+		if (node->backgroundPid != '\0') {
+			pids[i] = node->backgroundPid;
+			pidfds[i].fd = openPidfd(pids[i]);
+			pidfds[i].events = POLLIN;
+			if (pidfds[i].fd == -1) {
+				allPidfds = 0;
+			}
+
+			if (kill(-pids[i], SIGTERM) == -1) {
+				kill(pids[i], SIGTERM);
+			}
+			if (node->timerFd != -1) {
+				close(node->timerFd);
+				node->timerFd = -1;
+			}
+			node->backgroundPid = '\0';
+			i++;
+		}
+	}
+
+	// Wait for the jobs to exit until they are all gone or the grace period is up
+	long long deadline = monotonicMs() + graceMs;
+	long long timeLeft;
+	remaining = numJobs;
+
+	while (1) {
+
+		// Reap any jobs that have exited
+		for (i = 0; i < numJobs; i++) {
+			if (pids[i] != 0 && waitpid(pids[i], &childStatus, WNOHANG) != 0) {
+				pids[i] = 0;
+				if (pidfds[i].fd != -1) {
+					close(pidfds[i].fd);
+				}
+				pidfds[i].fd = -1;
+				exited++;
+				remaining--;
+			}
+		}
+
+		timeLeft = deadline - monotonicMs();
+		if (remaining == 0 || timeLeft <= 0) {
+			break;
+		}
+
+		// Without pidfds for every job, fall back to checking again every few milliseconds
+		if (allPidfds == 0 && timeLeft > 10) {
+			timeLeft = 10;
+		}
+		poll(pidfds, numJobs, timeLeft);
+	}
+
+	// Kill whatever is left and reap it
+	for (i = 0; i < numJobs; i++) {
+		if (pids[i] != 0) {
+			if (kill(-pids[i], SIGKILL) == -1) {
+				kill(pids[i], SIGKILL);
+			}
+			waitpid(pids[i], &childStatus, 0);
+			if (pidfds[i].fd != -1) {
+				close(pidfds[i].fd);
+			}
+			killed++;
+		}
+	}
+
+	printf("%d background job(s) exited, %d killed after %lld ms\n", exited, killed, graceMs);
+	fflush(stdout);
+
+	free(pids);
+	free(pidfds);
+
+	// Return 0 to the runSmallsh variable in main which will cause the shell to terminate
+	return 0;
+
+}
+
+/*
+* Open the history file so commands can be appended to it. The file is $SMALLSH_HISTFILE if it is set, otherwise ~/.smallsh_history. If
+* the file cannot be opened, history is turned off for this session.
+*/
+void historyOpen(void) {
+
+	char* path = getenv("SMALLSH_HISTFILE");
+	char* homePath = NULL;
+
+	if (path == NULL) {
+		char* home = getenv("HOME");
+		if (home == NULL) {
 			return;
 		}
+		homePath = calloc(strlen(home) + strlen(HISTFILE) + 2, sizeof(char));
+		sprintf(homePath, "%s/%s", home, HISTFILE);
+		path = homePath;
+	}
+
+	historyLog.fd = moveFdHigh(open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600));
+	historyLog.buckets = calloc(HISTORY_BUCKETS, sizeof(struct postingList));
+
+	free(homePath);
+}
+
+/*
+* Append a command to the history file. The header and text are written with a single write() to a file opened with O_APPEND, so appending
+* is O(1) and records from several smallsh sessions writing at once never overlap. Takes in the command text, its wait status (-1 for
+* background jobs) and how long it ran in milliseconds.
+*/
+void historyAppend(char* text, int status, long long durationMs) {
+
+	if (historyLog.fd == -1) {
+		return;
+	}
+
+	size_t length = strcspn(text, "\n");
+	size_t recordSize = sizeof(struct historyRecord) + HISTORY_PAD(length + 1);
+
+	char* record = calloc(recordSize, sizeof(char));
+	struct historyRecord* header = (struct historyRecord*)record;
+
+	header->magic = HISTORY_MAGIC;
+	header->length = length;
+	header->status = status;
+	header->timestamp = time(NULL);
+	header->durationMs = durationMs;
+	memcpy(record + sizeof(struct historyRecord), text, length);
+
+	write(historyLog.fd, record, recordSize);
+
+	free(record);
+}
+
+/*
+* Find the posting list in the trigram index for the three characters starting at text.
+*/
+struct postingList* historyBucket(const char* text) {
+
+	unsigned int hash = ((unsigned char)text[0] * 31 + (unsigned char)text[1]) * 31 + (unsigned char)text[2];
+	return &historyLog.buckets[hash % HISTORY_BUCKETS];
+}
+
+/*
+* Bring the memory map and trigram index up to date with the history file. Records appended since the last call, including those from other
+* sessions, are mapped and added to the index, so the file is only ever read once. Damaged records are skipped, and a record that is still
+* incomplete is left until the file grows.
+*/
+void historySync(void) {
+
+	struct stat fileStat;
+	struct historyRecord* header;
+	struct postingList* bucket;
+	char* text;
+	size_t recordSize;
+	size_t i;
+
+	if (historyLog.fd == -1 || fstat(historyLog.fd, &fileStat) == -1 || fileStat.st_size <= historyLog.mapSize) {
+		return;
+	}
+
+	// Grow the mapping to cover the whole file
+	char* map = (historyLog.map == NULL)
+		? mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, historyLog.fd, 0)
+		: mremap(historyLog.map, historyLog.mapSize, fileStat.st_size, MREMAP_MAYMOVE);
+	if (map == MAP_FAILED) {
+		return;
+	}
+	historyLog.map = map;
+	historyLog.mapSize = fileStat.st_size;
+
+	// Index the new records
+	while (historyLog.indexedSize + sizeof(struct historyRecord) <= historyLog.mapSize) {
+		header = (struct historyRecord*)(map + historyLog.indexedSize);
+		recordSize = sizeof(struct historyRecord) + HISTORY_PAD((size_t)header->length + 1);
+
+		// A damaged record, such as one left by a write that was cut short, is skipped by looking for the next record on an 8-byte
+		// boundary. If there is none yet, the record may still be being written, so it is looked at again once the file grows
+		if (header->magic != HISTORY_MAGIC || recordSize > historyLog.mapSize - historyLog.indexedSize
+			|| map[historyLog.indexedSize + sizeof(struct historyRecord) + header->length] != '\0') {
+
+			for (i = historyLog.indexedSize + 8; i + sizeof(struct historyRecord) <= historyLog.mapSize; i += 8) {
+				if (((struct historyRecord*)(map + i))->magic == HISTORY_MAGIC) {
+					break;
+				}
+			}
+			if (i + sizeof(struct historyRecord) > historyLog.mapSize) {
+				break;
+			}
+			historyLog.indexedSize = i;
+			continue;
+		}
+
+		if (historyLog.numRecords == historyLog.capRecords) {
+			historyLog.capRecords = (historyLog.capRecords == 0) ? 1024 : historyLog.capRecords * 2;
+			historyLog.offsets = realloc(historyLog.offsets, historyLog.capRecords * sizeof(size_t));
+		}
+		historyLog.offsets[historyLog.numRecords] = historyLog.indexedSize;
+
+		// Add the record to the posting list of every trigram in its text, once per list
+		text = map + historyLog.indexedSize + sizeof(struct historyRecord);
+		for (i = 0; i + 2 < header->length; i++) {
+			bucket = historyBucket(text + i);
+			if (bucket->len > 0 && bucket->ids[bucket->len - 1] == historyLog.numRecords) {
+				continue;
+			}
+			if (bucket->len == bucket->cap) {
+				bucket->cap = (bucket->cap == 0) ? 8 : bucket->cap * 2;
+				bucket->ids = realloc(bucket->ids, bucket->cap * sizeof(uint32_t));
+			}
+			bucket->ids[bucket->len++] = historyLog.numRecords;
+		}
+
+		historyLog.numRecords++;
+		historyLog.indexedSize += recordSize;
+	}
+}
+
+/*
+* Print one history entry with its number, when it was run, how it ended, how long it took and the command. Takes in the record number.
+*/
+void historyPrint(size_t id) {
+
+	struct historyRecord* header = (struct historyRecord*)(historyLog.map + historyLog.offsets[id]);
+	char* text = (char*)header + sizeof(struct historyRecord);
+	time_t timestamp = header->timestamp;
+	char when[32];
+	char result[32];
+
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&timestamp));
+
+	if (header->status == -1) {
+		strcpy(result, "bg");
+	}
+	else if (header->status & TIMEDOUT_FLAG) {
+		strcpy(result, "timeout");
+	}
+	else if (WIFSIGNALED(header->status)) {
+		sprintf(result, "sig %d", WTERMSIG(header->status));
+	}
+	else {
+		sprintf(result, "exit %d", WEXITSTATUS(header->status));
+	}
+
+	printf("%6zu  %s  %-8s %8.3fs  %s\n", id + 1, when, result, header->durationMs / 1000.0, text);
+}
+
+/*
+* The history built-in. 'history [N]' shows the last N commands (20 by default), 'history -s TEXT' shows every command containing TEXT and
+* 'history -p TEXT' shows every command starting with TEXT. Searches use the trigram index to narrow the records down to the few that could
+* match, so they stay fast with millions of entries. Takes in the command.
+*/
+void showHistory(struct commandLine* currCommand) {
+
+	char** args = currCommand->extendArgs;
+	struct growBuf pattern = { NULL, 0, 0 };
+	struct postingList* bucket;
+	struct postingList* smallest = NULL;
+	size_t count = 20;
+	size_t length;
+	size_t id;
+	size_t i;
+	char* text;
+	int prefix;
+
+	historySync();
+
+	// With no search, list the most recent commands
+	if (args[1] == NULL || (strcmp(args[1], "-s") != 0 && strcmp(args[1], "-p") != 0)) {
+		if (args[1] != NULL) {
+			count = strtoul(args[1], NULL, 10);
+		}
+		for (id = (count < historyLog.numRecords) ? historyLog.numRecords - count : 0; id < historyLog.numRecords; id++) {
+			historyPrint(id);
+		}
+		fflush(stdout);
+		return;
+	}
+
+	prefix = (strcmp(args[1], "-p") == 0);
+
+	// Join the rest of the words into the text to search for
+	for (i = 2; args[i] != NULL; i++) {
+		length = strlen(args[i]);
+		growBufReserve(&pattern, length + 2);
+		if (i > 2) {
+			pattern.data[pattern.len++] = ' ';
+		}
+		memcpy(pattern.data + pattern.len, args[i], length);
+		pattern.len += length;
+	}
+	growBufReserve(&pattern, 1);
+	pattern.data[pattern.len] = '\0';
+
+	// Only the records in the shortest posting list of the pattern's trigrams can match. Short patterns have to check every record
+	for (i = 0; i + 2 < pattern.len; i++) {
+		bucket = historyBucket(pattern.data + i);
+		if (smallest == NULL || bucket->len < smallest->len) {
+			smallest = bucket;
+		}
+	}
+
+	size_t numCandidates = (smallest == NULL) ? historyLog.numRecords : smallest->len;
+	for (i = 0; i < numCandidates; i++) {
+		id = (smallest == NULL) ? i : smallest->ids[i];
+		text = historyLog.map + historyLog.offsets[id] + sizeof(struct historyRecord);
+
+		if (prefix ? strncmp(text, pattern.data, pattern.len) == 0 : strstr(text, pattern.data) != NULL) {
+			historyPrint(id);
+		}
+	}
+	fflush(stdout);
+
+	free(pattern.data);
+}
+
+/*
+* Function changes the working directory of smallsh. If there are no arguments, the directory will be changed to the one
+* specified in the HOME environment variable. This function can also process a single argument which is the (relative or absolute)
+* path of a directory to change to. This function takes in the current command as an argument
+* 
+* Citation: Adapted from Module 4 - Processes; Exploration: Environment; Example 
+*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-environment?module_item_id=21835975
+*/
+void changeDir(struct commandLine* currCommand) {
+
+	// If no argument is passed, set the current working directory to HOME
+	if (currCommand->arguments[0] == NULL) {
+		chdir(getenv("HOME"));
+
+	}
+	// If an argument is passed, change the current working directory to the path in the argument
+	else {
+		chdir(currCommand->arguments[0]);
+
+	}
+}
+
+/*
+* Function checks the exit status or termination signal of the last foreground process run by the shell. Takes in the 
+* exitStatus variable.
+* 
+* Citation: Adapted from Module 4 - Processes; Exploration: Process API - Monitoring Child Processes; Example in Interpreting the Termination Status section
+*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-process-api-monitoring-child-processes?module_item_id=21835973
+*/
+void checkStatus(int exitStatus) {
+
+	// Variable used for printing exit status/signal
+	int pExitStatus;
+
+	// Report processes killed by the timeout built-in, then describe how they ended
+	if (exitStatus & TIMEDOUT_FLAG) {
+		printf("timed out, ");
+		exitStatus &= ~TIMEDOUT_FLAG;
+	}
+
+	// Checks to see if the process terminated normally
+	if (WIFEXITED(exitStatus) != 0) {
+
+		// If the process terminated normally, get the exit status value
+		pExitStatus = WEXITSTATUS(exitStatus);
+		printf("exit value %d\n", pExitStatus);
+		fflush(stdout);
+	}
+
+	// Otherwise, the process terminated abnormally
+	else if (WIFSIGNALED(exitStatus) != 0) {
+
+		// Get the signal number that caused the child to terminate abnormally
+		pExitStatus = WTERMSIG(exitStatus);
+		printf("terminated by signal %d\n", pExitStatus);
+		fflush(stdout);
+	}
+	else {
+		printf("%d\n", 0);
+		fflush(stdout);
+	}
+}
+
+/*
+* Move an open file descriptor to the number a redirection asked for. The original is closed so it does not leak into the command, and the
+* close-on-exec flag the shell opens every file with is cleared on the new descriptor. Takes in the open file descriptor and the one it should become.
+*/
+void moveFd(int openFd, int fd) {
+
+	if (openFd == fd) {
+		fcntl(fd, F_SETFD, 0);
+		return;
+	}
+
+	if (dup2(openFd, fd) == -1) {
+		printf("redirection of file descriptor %d failed\n", fd);
+		exit(2);
+	}
+	close(openFd);
+}
+
+/*
+* Redirect a file descriptor to in-memory data for a here-document or here-string. The data is written to an anonymous memfd which is then
+* sealed against further changes and rewound, so no file is created on disk and no helper process is needed to feed a pipe. Takes in the
+* data to use as input and the file descriptor to redirect.
+*/
+void hereRedirect(char* data, int fd) {
+
+	size_t length = strlen(data);
+	size_t written = 0;
+	ssize_t result;
+
+	int hereFd = memfd_create("smallsh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (hereFd == -1) {
+		printf("cannot create here-document\n");
+		exit(1);
+	}
+
+	// Write all of the data. Unlike a pipe, the memfd never fills up so large documents cannot deadlock
+	while (written < length) {
+		result = write(hereFd, data + written, length - written);
+		if (result == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			printf("cannot write here-document\n");
+			exit(1);
+		}
+		written += result;
+	}
+
+	// Seal the contents and rewind so the command reads from the beginning
+	fcntl(hereFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+	lseek(hereFd, 0, SEEK_SET);
+
+	moveFd(hereFd, fd);
+}
+
+/*
+* Preprocess redirection: Open files necessary for the redirections and apply them in the order they were given, so that '> file 2>&1' sends
+* both stdout and stderr to the file. Files are opened with O_CLOEXEC and moved onto the requested descriptor, so no extra descriptors are
+* left open in the command. Output opened with '>>' uses O_APPEND so several jobs can append to one log without overwriting each other.
+*
+* Citation: Adapted from Module 5 - Processes II; Exploration: Processes and I/O; Example: Redirecting both Stdin and Stdout
+*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-processes-and-i-slash-o?module_item_id=21835982
+*/
+void procRedirect(struct commandLine* currCommand) {
+
+	struct redirect* redirection;
+	int openFd;
+	int sourceFd;
+	char* end;
+	int i;
+
+	for (i = 0; i < currCommand->numRedirections; i++) {
+		redirection = &currCommand->redirection[i];
+
+		if (redirection->target == NULL) {
+			printf("missing target for redirection of file descriptor %d\n", redirection->fd);
+			exit(1);
+		}
+
+		switch (redirection->type) {
+
+		case REDIR_INPUT:
+			// Open file that will be the source
+			openFd = open(redirection->target, O_RDONLY | O_CLOEXEC);
+			if (openFd == -1) {
+				printf("cannot open %s for input\n", redirection->target);
+				exit(1);
+			}
+			moveFd(openFd, redirection->fd);
+			break;
+
+		case REDIR_OUTPUT:
+		case REDIR_APPEND:
+			// Open file that will be the destination, either truncating it or appending to it
+			openFd = open(redirection->target, O_WRONLY | O_CREAT | O_CLOEXEC | (redirection->type == REDIR_APPEND ? O_APPEND : O_TRUNC), 0644);
+			if (openFd == -1) {
+				printf("cannot open %s for output\n", redirection->target);
+				exit(1);
+			}
+			moveFd(openFd, redirection->fd);
+			break;
+
+		case REDIR_DUP:
+			// '-' closes the file descriptor, otherwise it becomes a copy of the one given
+			if (strcmp(redirection->target, "-") == 0) {
+				close(redirection->fd);
+				break;
+			}
+
+			sourceFd = strtol(redirection->target, &end, 10);
+			if (end == redirection->target || *end != '\0' || fcntl(sourceFd, F_GETFD) == -1) {
+				printf("%s: bad file descriptor\n", redirection->target);
+				exit(1);
+			}
+			if (sourceFd != redirection->fd && dup2(sourceFd, redirection->fd) == -1) {
+				printf("redirection of file descriptor %d failed\n", redirection->fd);
+				exit(2);
+			}
+			break;
+
+		default:
+			hereRedirect(redirection->target, redirection->fd);
+			break;
+		}
+	}
+}
+
+/*
+* Function performs default redirection for background processes. Will use dev/null for both input and output. Will be run before any 
+* redirection specified in the command so that it can be overwritten if necessary. Takes in the current command as an argument.
+* 
+* Citation: Adapted from Module 5 - Processes II; Exploration: Processes and I/O; Example: Redirecting both Stdin and Stdout
+*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-processes-and-i-slash-o?module_item_id=21835982
+*/
+void bgRedirect(struct commandLine* currCommand) {
+	// Open file that will be the source
+	int redirectFrom = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (redirectFrom == -1) {
+		printf("source open failed");
+		exit(1);
+	}
+
+	// Redirect stdin to the source file
+	moveFd(redirectFrom, 0);
+
+	// Open file that will be the destination
+	int redirectTo = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (redirectTo == -1) {
+		printf("target open failed");
+		exit(1);
+	}
+
+	// Redirect stdout to the destination file
+	moveFd(redirectTo, 1);
+}
+
+/*
+* Function adds pid to the list of jobs running in the background so that periodic checks can be done on completed
+* background jobs. Function takes in the pid that needs to be added, the timerfd and signal for its timeout (-1 if it has none) along with the head of the list. 
+*/
+void addToBgList(int spawnpid, int timerFd, int timeoutSig, struct bgPid* bgList) {
+
+	// Iterate through the linked list to add the child pid to the first available node
+	while (bgList != NULL) {
+
+		// If an empty node is found, add the child pid to the node and exit the loop
+		if (bgList->backgroundPid == '\0') {
+			bgList->backgroundPid = spawnpid;
+			bgList->timerFd = timerFd;
+			bgList->timeoutSig = timeoutSig;
+			bgList->timedOut = 0;
+			return;
+		}
+
+		// If the end of the list is found without finding any empty nodes, create a new node for the child pid
+		if (bgList->next == NULL) {
+			struct bgPid* currChild = malloc(sizeof(struct bgPid));
+
+			currChild->backgroundPid = spawnpid;
+			currChild->timerFd = timerFd;
+			currChild->timeoutSig = timeoutSig;
+			currChild->timedOut = 0;
+			currChild->next = NULL;
+			bgList->next = currChild;
+			return;
+		}
+
+		bgList = bgList->next;
+	}
+
+}
+
+/*
+* Free the linked list of background child pids. Takes in the head of the linked list as an argument and frees each node of the list.
+* 
+* Citation: Adapted on 2/1/2022 from Canvas post from Professor Gambord:
+* https://edstem.org/us/courses/16718/discussion/1020375
+*/
+void freeBgPidList(struct bgPid* bgList) {
+	if (bgList != NULL) {
+		freeBgPidList(bgList->next);
+		free(bgList);
+	}
+}
+
+/*
+* Free the current command line. Takes in the command line as an argument.
+* 
+* Citation: Adapted on 2/1/2022 from Canvas post from Professor Gambord:
+* https://edstem.org/us/courses/16718/discussion/1020375
+*/
+void freeCurrCommand(struct commandLine* currCommand) {
+	if (currCommand != NULL) {
+
+		int i;
+
+		free(currCommand->command);
+
+		// The arguments share their words with the extended arguments array, so only the array itself is freed
+		free(currCommand->arguments);
+
+		// Iterate through the extended arguments array and free memory used for any individual arguments
+		for (i = 0; i < currCommand->numArgs; i++) {
+			free(currCommand->extendArgs[i]);
+		}
+		free(currCommand->extendArgs);
+
+		// Iterate through the redirections and free memory used for any individual redirections
+		for (i = 0; i < currCommand->numRedirections; i++) {
+			free(currCommand->redirection[i].target);
+		}
+		free(currCommand->redirection);
+		
+		// Free the memory allocated for launch options
+		free(currCommand->cgroup);
+		free(currCommand->cpuWeight);
+		free(currCommand->memoryMax);
+
+		// Free the memory allocated for the entire commandLine struct
+		free(currCommand);
+	}
+}
+
+/*
+* Convert a duration for the timeout built-in into milliseconds. The duration is a number (which may have a fraction) followed by an optional
+* unit: 's' for seconds (the default), 'm' for minutes, 'h' for hours or 'd' for days. strtod() also accepts 'nan' and 'inf', which are
+* rejected along with durations too long to count in milliseconds. Takes in the text and returns the duration, or -1 if it is invalid.
+*/
+long long parseDuration(char* text) {
+
+	char* unit;
+	double duration = strtod(text, &unit);
+
+	if (unit == text || isfinite(duration) == 0 || duration < 0) {
+		return -1;
+	}
+
+	if (strcmp(unit, "") == 0 || strcmp(unit, "s") == 0) {
+		duration *= 1000;
+	}
+	else if (strcmp(unit, "m") == 0) {
+		duration *= 60 * 1000;
+	}
+	else if (strcmp(unit, "h") == 0) {
+		duration *= 60 * 60 * 1000;
+	}
+	else if (strcmp(unit, "d") == 0) {
+		duration *= 24 * 60 * 60 * 1000;
+	}
+	else {
+		return -1;
+	}
+
+	if (duration >= LLONG_MAX) {
+		return -1;
+	}
+
+	// A duration under a millisecond still has a time limit, since 0 means none
+	return (duration > 0 && duration < 1) ? 1 : duration;
+}
+
+/*
+* Convert a signal name (with or without the SIG prefix) or number into a signal number. Takes in the text and returns the signal, or -1 if it is not known.
+*/
+int parseSignal(char* text) {
+
+	char* names[] = { "HUP", "INT", "QUIT", "KILL", "USR1", "USR2", "ALRM", "TERM", "CONT", "STOP" };
+	int numbers[] = { SIGHUP, SIGINT, SIGQUIT, SIGKILL, SIGUSR1, SIGUSR2, SIGALRM, SIGTERM, SIGCONT, SIGSTOP };
+	char* end;
+	int i;
+
+	// Accept plain signal numbers
+	long signo = strtol(text, &end, 10);
+	if (end != text && *end == '\0') {
+		return (signo > 0 && signo < NSIG) ? signo : -1;
+	}
+
+	if (strncmp(text, "SIG", 3) == 0) {
+		text += 3;
+	}
+
+	for (i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+		if (strcmp(text, names[i]) == 0) {
+			return numbers[i];
+		}
+	}
+
+	return -1;
+}
+
+/*
+* Drop the first count words of a command so that the word after them becomes the command. Used by built-ins that wrap another command.
+* Takes in the command and the number of words to drop.
+*/
+void shiftArgs(struct commandLine* currCommand, int count) {
+
+	int i;
+
+	for (i = 0; i < count; i++) {
+		free(currCommand->extendArgs[i]);
+	}
+
+	// Move the remaining words, and the NULL that ends each array, to the front of both argument arrays
+	currCommand->numArgs -= count;
+	memmove(currCommand->extendArgs, currCommand->extendArgs + count, (currCommand->numArgs + 1) * sizeof(char*));
+	memmove(currCommand->arguments, currCommand->arguments + count, currCommand->numArgs * sizeof(char*));
+
+	free(currCommand->command);
+	currCommand->command = calloc(strlen(currCommand->extendArgs[0]) + 1, sizeof(char));
+	strcpy(currCommand->command, currCommand->extendArgs[0]);
+}
+
+/*
+* Process the timeout built-in: 'timeout DURATION [-s SIGNAL] COMMAND [ARG]...'. The signal option may also come before the duration. The
+* time limit and signal are saved in the command and the timeout words are removed so that the wrapped command is what gets run. Takes in
+* the command and returns 0 on success or -1 if the arguments are invalid.
+*/
+int timeoutCommand(struct commandLine* currCommand) {
+
+	char** args = currCommand->extendArgs;
+	int i = 1;
+
+	if (args[i] != NULL && strcmp(args[i], "-s") == 0 && args[i + 1] != NULL) {
+		currCommand->timeoutSig = parseSignal(args[i + 1]);
+		i += 2;
+	}
+
+	if (args[i] == NULL || (currCommand->timeoutMs = parseDuration(args[i])) == -1) {
+		return -1;
+	}
+	i++;
+
+	if (args[i] != NULL && strcmp(args[i], "-s") == 0 && args[i + 1] != NULL) {
+		currCommand->timeoutSig = parseSignal(args[i + 1]);
+		i += 2;
+	}
+
+	if (currCommand->timeoutSig == -1 || args[i] == NULL) {
+		return -1;
+	}
+
+	shiftArgs(currCommand, i);
+	return 0;
+}
+
+/*
+* Check that a command's arguments and the environment fit within the kernel's limit for exec(), which is the only limit on the size of a
+* command. Takes in the command and returns 1 if it fits, or prints an error and returns 0 if it does not.
+*/
+int checkArgMax(struct commandLine* currCommand) {
+
+	long argMax = sysconf(_SC_ARG_MAX);
+	size_t total = 0;
+	int i;
+
+	// exec() copies every string along with a pointer to it
+	for (i = 0; i < currCommand->numArgs; i++) {
+		total += strlen(currCommand->extendArgs[i]) + 1 + sizeof(char*);
+	}
+	for (i = 0; environ[i] != NULL; i++) {
+		total += strlen(environ[i]) + 1 + sizeof(char*);
+	}
+
+	if (argMax > 0 && total > argMax) {
+		printf("%s: argument list too long (%zu bytes, limit %ld)\n", currCommand->command, total, argMax);
+		fflush(stdout);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+* Create a timerfd that expires once after the given number of milliseconds. Takes in the time and returns the timerfd, or -1 on failure.
+*/
+int armTimer(long long timeoutMs) {
+
+	struct itimerspec expiry = { { 0, 0 }, { 0, 0 } };
+	expiry.it_value.tv_sec = timeoutMs / 1000;
+	expiry.it_value.tv_nsec = (timeoutMs % 1000) * 1000000;
+
+	int timerFd = moveFdHigh(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+	if (timerFd != -1 && timerfd_settime(timerFd, 0, &expiry, NULL) == -1) {
+		close(timerFd);
+		timerFd = -1;
+	}
+
+	return timerFd;
+}
+
+/*
+* Make a process group the foreground process group of the terminal. SIGTTOU is blocked so that a process that is not in the foreground
+* can hand the terminal over without being stopped. Takes in the process group id.
+*/
+void giveTerminal(pid_t pgid) {
+
+	sigset_t blockSIGTTOU;
+	sigset_t prevMask;
+
+	sigemptyset(&blockSIGTTOU);
+	sigaddset(&blockSIGTTOU, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &blockSIGTTOU, &prevMask);
+
+	tcsetpgrp(0, pgid);
+
+	sigprocmask(SIG_SETMASK, &prevMask, NULL);
+}
+
+/*
+* Wait for a foreground command. The child's pidfd, the timerfd of a command run with the timeout built-in, the timers of the background
+* jobs and the capture pipe of a command substitution are polled together, so the shell sleeps until the child exits, a timer expires or
+* output arrives. If the command's own timer expires, the child's process group is sent the timeout signal and the returned status is marked
+* with TIMEDOUT_FLAG. A captured command is waited on until it has exited and its output has all been read. Takes in the child pid, the
+* command, the list of background processes, and the read end of the capture pipe and the buffer to read it into, or -1 and NULL. Returns
+* the wait status of the child.
+*/
+int waitForeground(pid_t spawnpid, struct commandLine* currCommand, struct bgPid* bgList, int captureFd, struct growBuf* buf) {
+
+	int childStatus = 0;
+	int timedOut = 0;
+	int exited = 0;
+	ssize_t bytesRead;
+	struct pollfd fds[3];
+
+	fds[0].fd = openPidfd(spawnpid);
+	fds[0].events = POLLIN;
+	fds[1].fd = (currCommand->timeoutMs > 0) ? armTimer(currCommand->timeoutMs) : -1;
+	fds[1].events = POLLIN;
+	fds[2].fd = captureFd;
+	fds[2].events = POLLIN;
+
+	while (1) {
+
+		// Once the child has exited its pidfd and timer are no longer needed
+		if (exited == 0 && waitpid(spawnpid, &childStatus, WNOHANG) != 0) {
+			exited = 1;
+			if (fds[0].fd != -1) {
+				close(fds[0].fd);
+				fds[0].fd = -1;
+			}
+			if (fds[1].fd != -1) {
+				close(fds[1].fd);
+				fds[1].fd = -1;
+			}
+		}
+		if (exited == 1 && fds[2].fd == -1) {
+			break;
+		}
+
+		// Without a pidfd, fall back to checking on the child every few milliseconds
+		if (checkBgTimers(bgList, fds, 3, (exited == 0 && fds[0].fd == -1) ? 10 : -1) <= 0) {
+			continue;
+		}
+
+		if (fds[1].revents & POLLIN) {
+
+			// Keep waiting in the loop, still serving the background timers, until the child has acted on the signal
+			sendTimeout(spawnpid, currCommand->timeoutSig);
+			close(fds[1].fd);
+			fds[1].fd = -1;
+			timedOut = 1;
+		}
+
+		// Read whatever output is ready. The capture is done once the pipe reaches end of file
+		if (fds[2].revents & (POLLIN | POLLHUP | POLLERR)) {
+			growBufReserve(buf, 4096);
+			bytesRead = read(fds[2].fd, buf->data + buf->len, buf->cap - buf->len);
+			if (bytesRead > 0) {
+				buf->len += bytesRead;
+			}
+			else if (bytesRead == 0 || errno != EINTR) {
+				fds[2].fd = -1;
+			}
+		}
+	}
+
+	return timedOut ? childStatus | TIMEDOUT_FLAG : childStatus;
+}
+
+/*
+* Parse a list of CPUs such as '0-3:6' into a CPU set. Items are separated by ':' because ',' separates words on a smallsh command line, and
+* each item is either a single CPU or a range. Takes in the text and the set to fill. Returns 0 on success or -1 if the list is invalid.
+*/
+int parseCpuList(char* text, cpu_set_t* cpus) {
+
+	char* end;
+	long first;
+	long last;
+
+	CPU_ZERO(cpus);
+
+	while (1) {
+		first = strtol(text, &end, 10);
+		if (end == text || first < 0) {
+			return -1;
+		}
+		last = first;
+
+		// Check for a range of CPUs
+		if (*end == '-') {
+			text = end + 1;
+			last = strtol(text, &end, 10);
+			if (end == text || last < first) {
+				return -1;
+			}
+		}
+
+		if (last >= CPU_SETSIZE) {
+			return -1;
+		}
+		for (; first <= last; first++) {
+			CPU_SET(first, cpus);
+		}
+
+		if (*end == '\0') {
+			return 0;
+		}
+		if (*end != ':') {
+			return -1;
+		}
+		text = end + 1;
+	}
+}
+
+/*
+* Process launch options given before a command, such as 'cpus=0-3 nice=10 cgroup=batch sleep 100 &'. The options are 'cpus' (CPU affinity),
+* 'nice' (scheduling priority), 'cgroup' (cgroup v2 group to run in), and 'weight' and 'mem' (cpu.weight and memory.max for that group). They
+* are saved in the command and removed so the command after them is what gets run. Takes in the command and returns 0 on success or -1 if an
+* option is invalid.
+*/
+int launchOptions(struct commandLine* currCommand) {
+
+	char** args = currCommand->extendArgs;
+	char* value;
+	char* end;
+	int i = 0;
+
+	while (args[i] != NULL && (value = strchr(args[i], '=')) != NULL) {
+		value++;
+
+		if (strncmp(args[i], "cpus=", 5) == 0) {
+			if (parseCpuList(value, &currCommand->cpus) == -1) {
+				return -1;
+			}
+			currCommand->hasCpus = 1;
+		}
+		else if (strncmp(args[i], "nice=", 5) == 0) {
+			currCommand->niceValue = strtol(value, &end, 10);
+			if (end == value || *end != '\0') {
+				return -1;
+			}
+			currCommand->hasNice = 1;
+		}
+		else if (strncmp(args[i], "cgroup=", 7) == 0) {
+			free(currCommand->cgroup);
+			currCommand->cgroup = calloc(strlen(value) + 1, sizeof(char));
+			strcpy(currCommand->cgroup, value);
+		}
+		else if (strncmp(args[i], "weight=", 7) == 0) {
+			free(currCommand->cpuWeight);
+			currCommand->cpuWeight = calloc(strlen(value) + 1, sizeof(char));
+			strcpy(currCommand->cpuWeight, value);
+		}
+		else if (strncmp(args[i], "mem=", 4) == 0) {
+			free(currCommand->memoryMax);
+			currCommand->memoryMax = calloc(strlen(value) + 1, sizeof(char));
+			strcpy(currCommand->memoryMax, value);
+		}
+
+		// Anything else is not a launch option, so treat it as the command
+		else {
+			break;
+		}
+		i++;
+	}
+
+	// The cgroup limits only make sense along with a cgroup, and there must be a command left to run
+	if ((currCommand->cgroup == NULL && (currCommand->cpuWeight != NULL || currCommand->memoryMax != NULL)) || args[i] == NULL) {
+		return -1;
+	}
+
+	if (i > 0) {
+		shiftArgs(currCommand, i);
+	}
+
+	return 0;
+}
+
+/*
+* Write a value to one of the files in a cgroup directory. Takes in the directory, the file name and the value. Returns 0 on success or -1 on failure.
+*/
+int writeCgroupFile(char* cgroupPath, char* fileName, char* value) {
+
+	char* filePath = calloc(strlen(cgroupPath) + strlen(fileName) + 2, sizeof(char));
+	sprintf(filePath, "%s/%s", cgroupPath, fileName);
+
+	int fileFd = open(filePath, O_WRONLY | O_CLOEXEC);
+	free(filePath);
+	if (fileFd == -1) {
+		return -1;
+	}
+
+	int result = write(fileFd, value, strlen(value));
+	close(fileFd);
+
+	return (result == -1) ? -1 : 0;
+}
+
+/*
+* Find the directory that cgroup= groups are created in. This is the SMALLSH_CGROUP_ROOT environment variable if it is set, and otherwise
+* smallsh's own cgroup as given by the "0::" line of /proc/self/cgroup. cgroup v2 only lets a group hand controllers such as cpu and memory
+* to the groups under it while it has no processes of its own, so the first time smallsh's own cgroup is used smallsh moves itself into a
+* 'shell' group under it. The directory is found once and kept in cgroupBase, which must be done in smallsh before forking. Returns the path.
+*/
+char* cgroupRoot(void) {
+
+	char* root = getenv("SMALLSH_CGROUP_ROOT");
+	char* line = NULL;
+	size_t lineSize = 0;
+	ssize_t lineLen;
+
+	if (cgroupBase != NULL) {
+		return cgroupBase;
+	}
+
+	if (root != NULL) {
+		cgroupBase = strdup(root);
+		return cgroupBase;
+	}
+
+	FILE* cgroupFile = fopen("/proc/self/cgroup", "re");
+	if (cgroupFile != NULL) {
+		while ((lineLen = getline(&line, &lineSize, cgroupFile)) != -1) {
+			if (strncmp(line, "0::", 3) == 0) {
+				if (line[lineLen - 1] == '\n') {
+					line[lineLen - 1] = '\0';
+				}
+				root = calloc(strlen(CGROUP_MOUNT) + strlen(line + 3) + 1, sizeof(char));
+				sprintf(root, "%s%s", CGROUP_MOUNT, (strcmp(line + 3, "/") == 0) ? "" : line + 3);
+				break;
+			}
+		}
+		free(line);
+		fclose(cgroupFile);
+	}
+
+	// Without a cgroup v2 entry, fall back to the top of the hierarchy
+	cgroupBase = (root != NULL) ? root : strdup(CGROUP_MOUNT);
+
+	// Leave the group empty so its controllers can be enabled for the groups under it. The root cgroup is exempt from this rule. If smallsh
+	// cannot move, setting a limit reports why
+	if (strcmp(cgroupBase, CGROUP_MOUNT) != 0) {
+		char* shellPath = calloc(strlen(cgroupBase) + strlen("/shell") + 1, sizeof(char));
+		sprintf(shellPath, "%s/shell", cgroupBase);
+		mkdir(shellPath, 0755);
+		writeCgroupFile(shellPath, "cgroup.procs", "0");
+		free(shellPath);
+	}
+
+	return cgroupBase;
+}
+
+/*
+* Set a limit on a cgroup, first enabling its controller for the groups under the parent. cgroup v2 refuses this if the parent still has
+* processes of its own, so a limit that cannot be set is reported rather than silently dropped. Takes in the parent and group directories,
+* the controller, the limit file and the value.
+*/
+void setCgroupLimit(char* root, char* cgroupPath, char* controller, char* fileName, char* value) {
+
+	char* enable = calloc(strlen(controller) + 2, sizeof(char));
+	sprintf(enable, "+%s", controller);
+	writeCgroupFile(root, "cgroup.subtree_control", enable);
+	free(enable);
+
+	if (writeCgroupFile(cgroupPath, fileName, value) == -1) {
+		printf("smallsh: %s=%s not applied to cgroup %s: %s\n", fileName, value, cgroupPath, strerror(errno));
+		fflush(stdout);
+	}
+}
+
+/*
+* Move the current process into the cgroup v2 group named in the command, creating the group if needed. The group lives under cgroupRoot(),
+* which smallsh has already found before forking. cpu.weight and memory.max are set when they were asked for, with a message if they could
+* not be. Exits if the process cannot join the group. Takes in the command.
+*/
+void joinCgroup(struct commandLine* currCommand) {
+
+	char* root = cgroupRoot();
+
+	char* cgroupPath = calloc(strlen(root) + strlen(currCommand->cgroup) + 2, sizeof(char));
+	sprintf(cgroupPath, "%s/%s", root, currCommand->cgroup);
+
+	// Create the group if this is the first job to use it
+	mkdir(cgroupPath, 0755);
+
+	if (currCommand->cpuWeight != NULL) {
+		setCgroupLimit(root, cgroupPath, "cpu", "cpu.weight", currCommand->cpuWeight);
+	}
+	if (currCommand->memoryMax != NULL) {
+		setCgroupLimit(root, cgroupPath, "memory", "memory.max", currCommand->memoryMax);
+	}
+
+	// Writing 0 to cgroup.procs moves the writing process into the group
+	if (writeCgroupFile(cgroupPath, "cgroup.procs", "0") == -1) {
+		printf("cannot move %s into cgroup %s\n", currCommand->command, cgroupPath);
+		exit(1);
+	}
+
+	free(cgroupPath);
+}
+
+/*
+* Apply a command's launch options to the current process. This is run in the child between fork() and exec() so the command never runs
+* outside of its CPU set, priority or cgroup. Exits if an option cannot be applied. Takes in the command.
+*/
+void applyLaunchOptions(struct commandLine* currCommand) {
+
+	if (currCommand->hasCpus == 1 && sched_setaffinity(0, sizeof(cpu_set_t), &currCommand->cpus) == -1) {
+		printf("cannot set cpus for %s\n", currCommand->command);
+		exit(1);
+	}
+
+	if (currCommand->hasNice == 1 && setpriority(PRIO_PROCESS, 0, currCommand->niceValue) == -1) {
+		printf("cannot set nice value for %s\n", currCommand->command);
+		exit(1);
+	}
+
+	if (currCommand->cgroup != NULL) {
+		joinCgroup(currCommand);
+	}
+}
+
+/*
+* Fork a child process and replace it with the command program. The child sets up its signal handlers and redirections before calling
+* execvp(). Takes in a commandLine struct and returns the pid of the child to the parent, or -1 if fork() failed. Shared by otherCommand()
+* and command substitution so that every external command is started the same way.
+*/
+pid_t spawnCommand(struct commandLine* currCommand) {
+
+	// Let the command read any input the shell has read ahead of it
+	unreadInput();
+
+	pid_t spawnpid = fork();
+
+	if (spawnpid != 0) {
+		return spawnpid;
+	}
+
+	// Allow SIGINT to terminate process if it is running in the foreground
+	if (currCommand->background == 0) {
+		changeSIGINT();
+	}
+
+	if (fgOnly == 0) {
+		initSIGTSTP();
+	}
+
+	// Put background jobs in their own process group so the whole job can be signalled at once
+	if (currCommand->background == 1 && fgOnly == 0) {
+		setpgid(0, 0);
+	}
+
+	// Foreground commands with a timeout get their own process group too, and take over the terminal if smallsh has it. Commands being
+	// captured for a command substitution leave the terminal with smallsh
+	else if (currCommand->timeoutMs > 0) {
+		int ownsTerminal = currCommand->outputFd == -1 && isatty(0) && tcgetpgrp(0) == getpgrp();
+		setpgid(0, 0);
+		if (ownsTerminal) {
+			giveTerminal(getpid());
+		}
+	}
+
+	// Apply CPU affinity, priority and cgroup placement before the command starts running
+	applyLaunchOptions(currCommand);
+
+	// Check to see if the process should be run in the background
+	if (currCommand->background == 1) {
+		bgRedirect(currCommand);
+	}
+
+	// Send stdout into the capture pipe if the command is part of a command substitution
+	if (currCommand->outputFd != -1) {
+		if (dup2(currCommand->outputFd, 1) == -1) {
+			printf("capture redirection failed");
+			exit(2);
+		}
+	}
+
+	// Apply any redirections
+	procRedirect(currCommand);
+
+	// Replace the current program with the command program
+	execvp(currCommand->command, currCommand->extendArgs);
+
+	// execvp only returns if there's an error
+	if (errno == E2BIG) {
+		printf("%s: argument list too long\n", currCommand->command);
+	}
+	else {
+		printf("%s: no such file or directory\n", currCommand->command);
+	}
+	exit(1);
+}
+
+/*
+* Prepare a command that is not built-in to be run. Launch options and the timeout built-in are processed and removed so the command after
+* them is what gets run, and the command is checked against the kernel's limit on arguments. Errors are reported here. Takes in a
+* commandLine struct and returns 0 if the command can be run, otherwise the exit status to record for it.
+*/
+int prepareCommand(struct commandLine* currCommand) {
+
+	// Launch options such as 'cpus=0-3' and 'nice=10' can come before the command
+	if (strchr(currCommand->command, '=') != NULL && launchOptions(currCommand) == -1) {
+		printf("smallsh: invalid launch options\n");
+		fflush(stdout);
+		return 1 << 8;
+	}
+
+	// The timeout built-in wraps another command with a time limit. Report a usage error the same way coreutils timeout does
+	if (strcmp(currCommand->command, "timeout") == 0 && timeoutCommand(currCommand) == -1) {
+		printf("usage: timeout DURATION [-s SIGNAL] COMMAND [ARG]...\n");
+		fflush(stdout);
+		return 125 << 8;
+	}
+
+	// Make sure the command fits within the kernel's limit before forking
+	if (checkArgMax(currCommand) == 0) {
+		return 1 << 8;
+	}
+
+	// Find where cgroup= groups go while still in smallsh, since finding it the first time moves smallsh into a cgroup of its own
+	if (currCommand->cgroup != NULL) {
+		cgroupRoot();
+	}
+
+	return 0;
+}
+
+/*
+* Execute commands that are not built-in using fork(), exec() and waitpid(). Function takes in a commandLine struct as
+* an argument.
+* 
+* Citation 1: Adapted from Module 4 - Processes; Exploration: Process API - Executing a New Program.
+*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-process-api-executing-a-new-program?module_item_id=21835974
+* Citation 2: Default action adapted from Module 4 - Processes; Exploration: Process API - Monitoring Child Processes
+*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-process-api-monitoring-child-processes?module_item_id=21835973
+* Citation 3: sigprocmask technique adapted on 2/1/222 from: Kerrisk, Michael. Chapter 20. The Linux Programming Interface a Linux Und UNIX System Programming Handbook,
+*     No Starch Press, San Francisco, CA, 2018, p. 410-411.
+*/
+int otherCommand(struct commandLine* currCommand, struct bgPid* bgList) {
+
+	sigset_t blockSIGTSTP;
+	sigset_t prevMask;
+
+	// Process launch options and the timeout built-in, and check the arguments fit, before forking
+	int prepareStatus = prepareCommand(currCommand);
+	if (prepareStatus != 0) {
+		return prepareStatus;
+	}
+	
+	// Have the child process ignore SIGTSTP if not in foreground-only mode
+	if (fgOnly == 1) {
+		sigemptyset(&blockSIGTSTP);
+		sigaddset(&blockSIGTSTP, SIGTSTP);
+
+		sigprocmask(SIG_BLOCK, &blockSIGTSTP, &prevMask);
+	}
+	
+	// Create a holder for the head of the linked list. Used for resetting pointer to beginning of the list
+	struct bgPid* head = bgList;
+	
+	// Create variables for holding the child status for use during waitpid()
+	int childStatus = 0;
+	int bgChildStatus;
+
+	// Initialize spawnpid with an arbitrary id
+	pid_t spawnpid = -5;
+
+	int childDone;
+	int timerFd;
+
+	// Send the timeout signal to any background jobs that have run out of time
+	checkBgTimers(bgList, NULL, 0, 0);
+
+	// fork() a new child process and execute the command in it
+	spawnpid = spawnCommand(currCommand);
+
+	switch (spawnpid) {
+
+		// If fork() fails, set the exit status to -1
+	case -1:
+		perror("fork()\n");
+		childStatus = -1;
+		exit(-1);
+		break;
+
+		// Have the parent process wait for the child process to complete
+	default:
+
+		// Reset pointer to the head of the linked list
+		bgList = head;
+
+		// Check the pids running in the background to see if any have completed
+		while (bgList != NULL) {
+
+			// If the node holds a pid, check it to see if the job has finished and clean up
+			if (bgList->backgroundPid != '\0') {
+				childDone = waitpid(bgList->backgroundPid, &bgChildStatus, WNOHANG);
+
+				// If the child pid has finished, print message and remove it from linked list
+				if (childDone != 0) {
+					if (bgList->timedOut == 1) {
+						bgChildStatus |= TIMEDOUT_FLAG;
+					}
+					printf("background pid %d is done: ", bgList->backgroundPid);
+					checkStatus(bgChildStatus);
+
+					if (bgList->timerFd != -1) {
+						close(bgList->timerFd);
+					}
+					bgList->backgroundPid = '\0';
+					bgList->timerFd = -1;
+					bgList->timedOut = 0;
+				}
+			}
+
+			bgList = bgList->next;
+		}
+
+		// Reset pointer to the head of the linked list
+		bgList = head;
+
+		// Check if the current command should be run in the background and that the process is NOT in foreground-only mode
+		if (currCommand->background == 1 && fgOnly == 0) {
+
+
+			// Set the process group from the parent as well so it is in place before any signal can be sent to it
+			setpgid(spawnpid, spawnpid);
+
+			// If it should, print message and run waitpid with WNOHANG so the process can run in the background
+			printf("background pid is %d\n", spawnpid);
+			fflush(stdout);
+			childDone = waitpid(spawnpid, &bgChildStatus, WNOHANG);
+
+			// If the child pid has finished, print message and remove it from linked list
+			if (childDone != 0) {
+				printf("background pid %d is done: ", spawnpid);
+				checkStatus(bgChildStatus);
+			}
+			else {
+				// Otherwise, add the child pid to the list of jobs running in the background along with its timeout, if it has one
+				timerFd = (currCommand->timeoutMs > 0) ? armTimer(currCommand->timeoutMs) : -1;
+				addToBgList(spawnpid, timerFd, currCommand->timeoutSig, bgList);
+			}
+		}
+
+		// If the process should be run in the foreground or if process IS in foreground-only mode, wait to prompt user until process is complete
+		if (currCommand->background == 0 || fgOnly == 1) {
+
+			// Commands with a timeout are waited on together with their timer
+			if (currCommand->timeoutMs > 0) {
+				int ownsTerminal = isatty(0) && tcgetpgrp(0) == getpgrp();
+
+				setpgid(spawnpid, spawnpid);
+				if (ownsTerminal) {
+					giveTerminal(spawnpid);
+				}
+
+				childStatus = waitForeground(spawnpid, currCommand, bgList, -1, NULL);
+
+				// Take the terminal back from the command
+				if (ownsTerminal) {
+					giveTerminal(getpgrp());
+				}
+			}
+			else {
+				childStatus = waitForeground(spawnpid, currCommand, bgList, -1, NULL);
+			}
+
+			// Check to see if the process was terminated by SIGINT. 
+			if (childStatus == 2) {
+
+				// If it was, print message
+				printf("terminated by signal %d\n", childStatus);
+				fflush(stdout);
+			}
+
+			if (fgOnly == 1) {
+				sigprocmask(SIG_SETMASK, &prevMask, NULL);
+			}
+		}
+
+		break;
+	}
+
+	// Return the child status so it can be used when checking the status
+	return childStatus;
+}
+
+/*
+* Check whether a command is one of the commands built into smallsh. Takes in the command name and returns 1 if it is built-in and 0 otherwise.
+*/
+int isBuiltin(char* command) {
+	return strcmp(command, "exit") == 0 || strcmp(command, "cd") == 0 || strcmp(command, "status") == 0 || strcmp(command, "history") == 0
+		|| strcmp(command, "source") == 0;
+}
+
+/*
+* Run a built-in command inside of a command substitution without forking. stdout is temporarily pointed at an anonymous memfd so output of
+* any size can be captured without a reader on the other end, then the memfd is read into the buffer. 'exit', 'cd' and 'source' have no
+* effect here, the same as they would in a subshell. Takes in the command, the exit status of the last foreground process and the capture buffer.
+*/
+void captureBuiltin(struct commandLine* subCommand, int exitStatus, struct growBuf* buf) {
+
+	if (strcmp(subCommand->command, "status") != 0 && strcmp(subCommand->command, "history") != 0) {
+		return;
+	}
+
+	int captureFd = moveFdHigh(memfd_create("smallsh-subst", MFD_CLOEXEC));
+	if (captureFd == -1) {
+		perror("memfd_create()");
+		return;
+	}
+
+	// Point stdout at the memfd while the built-in runs
+	fflush(stdout);
+	int savedStdout = fcntl(1, F_DUPFD_CLOEXEC, 10);
+	dup2(captureFd, 1);
+
+	if (strcmp(subCommand->command, "status") == 0) {
+		checkStatus(exitStatus);
+	}
+	else {
+		showHistory(subCommand);
+	}
+
+	// Restore stdout and rewind the memfd so it can be read back
+	fflush(stdout);
+	dup2(savedStdout, 1);
+	close(savedStdout);
+
+	lseek(captureFd, 0, SEEK_SET);
+	readAllFd(captureFd, buf);
+	close(captureFd);
+}
+
+int cmdSubstitution(char** commandLinePtr, int exitStatus, struct growBuf* substOutput, struct bgPid* bgList);
+
+/*
+* Run the command inside of a '$(...)' and append its output to the buffer. External commands are prepared and started the same way
+* otherCommand() does, with stdout sent into a pipe that is read while waiting on the child, so time limits and background timeouts are
+* still served. Takes in the inner command text, the exit status of the last foreground process, the capture buffer and the list of
+* background processes.
+*/
+void captureCommand(char* innerText, int exitStatus, struct growBuf* buf, struct bgPid* bgList) {
+
+	int pipeFds[2];
+	pid_t spawnpid;
+
+	// Build the inner command the same way promptUser() would have left it so it can be parsed by processComm()
+	char* innerLine = calloc(strlen(innerText) + 2, sizeof(char));
+	sprintf(innerLine, "%s\n", innerText);
+
+	// Expand any nested substitutions first. Nothing is run if the inner command is blank
+	struct growBuf innerOutput = { NULL, 0, 0 };
+	if (cmdSubstitution(&innerLine, exitStatus, &innerOutput, bgList) == 0) {
+		free(innerOutput.data);
+		free(innerLine);
+		return;
+	}
+
+	struct commandLine* subCommand = processComm(innerLine, &innerOutput);
+	free(innerOutput.data);
+
+	// Built-in commands are run in-process without a fork
+	if (isBuiltin(subCommand->command)) {
+		captureBuiltin(subCommand, exitStatus, buf);
+	}
+
+	// Launch options, the timeout built-in and the argument limit are handled as for any other command. Errors go to the terminal and
+	// leave the output empty
+	else if (prepareCommand(subCommand) == 0) {
+		if (pipe2(pipeFds, O_CLOEXEC) == -1) {
+			perror("pipe()");
+		}
+		else {
+			// Substituted commands always run in the foreground so their output can be collected. Neither end of the pipe is left in
+			// the low file descriptors the command could name
+			pipeFds[0] = moveFdHigh(pipeFds[0]);
+			pipeFds[1] = moveFdHigh(pipeFds[1]);
+			subCommand->background = 0;
+			subCommand->outputFd = pipeFds[1];
+
+			spawnpid = spawnCommand(subCommand);
+			close(pipeFds[1]);
+
+			if (spawnpid == -1) {
+				perror("fork()");
+			}
+			else {
+				// Commands with a timeout lead their own process group so the timeout signal reaches all of it
+				if (subCommand->timeoutMs > 0) {
+					setpgid(spawnpid, spawnpid);
+				}
+				waitForeground(spawnpid, subCommand, bgList, pipeFds[0], buf);
+			}
+			close(pipeFds[0]);
+		}
+	}
+
+	freeCurrCommand(subCommand);
+	free(innerLine);
+}
+
+/*
+* Run every '$(command)' in the command line and replace it with SUBST_MARKER. The outputs are stored one after another, each ending with a
+* NUL, with trailing newlines and any NUL bytes dropped. processComm() splits them into words once the line is tokenised. Substitutions can be
+* nested. Takes in a pointer to the command line, which is replaced with a newly allocated string if anything is substituted, the exit status
+* of the last foreground process, the buffer for the outputs and the list of background processes. Returns 1 if there is still a command to
+* run and 0 if the line is now blank or an error occurred.
+*/
+int cmdSubstitution(char** commandLinePtr, int exitStatus, struct growBuf* substOutput, struct bgPid* bgList) {
+
+	char* commandLine = *commandLinePtr;
+
+	// Most command lines have nothing to substitute, so leave them untouched
+	if (strstr(commandLine, "$(") == NULL) {
+		return strspn(commandLine, " \t\n") != strlen(commandLine);
+	}
+
+	struct growBuf result = { NULL, 0, 0 };
+	size_t start;
+	size_t i = 0;
+	int depth;
+	int hasWords = 0;
+
+	while (commandLine[i] != '\0') {
+
+		// Copy ordinary characters over to the result. A marker typed by the user is dropped so each one left stands for an output
+		if (commandLine[i] != '$' || commandLine[i + 1] != '(') {
+			if (commandLine[i] != SUBST_MARKER) {
+				hasWords |= strchr(" \t\n", commandLine[i]) == NULL;
+				growBufReserve(&result, 1);
+				result.data[result.len++] = commandLine[i];
+			}
+			i++;
+			continue;
+		}
+
+		// Find the parenthesis that closes this substitution, allowing for nested ones
+		start = i + 2;
+		depth = 1;
+		for (i = start; commandLine[i] != '\0'; i++) {
+			if (commandLine[i] == '(') {
+				depth++;
+			}
+			else if (commandLine[i] == ')' && --depth == 0) {
+				break;
+			}
+		}
+
+		if (commandLine[i] == '\0') {
+			printf("smallsh: unmatched $(\n");
+			fflush(stdout);
+			free(result.data);
+			return 0;
+		}
+
+		// Capture the output of the inner command onto the end of the outputs and leave a marker in its place
+		commandLine[i] = '\0';
+		size_t outputStart = substOutput->len;
+		captureCommand(commandLine + start, exitStatus, substOutput, bgList);
+		i++;
+
+		growBufReserve(&result, 1);
+		result.data[result.len++] = SUBST_MARKER;
+
+		// Drop trailing newlines, and NUL bytes since each output ends with one
+		while (substOutput->len > outputStart && substOutput->data[substOutput->len - 1] == '\n') {
+			substOutput->len--;
+		}
+		if (memchr(substOutput->data + outputStart, '\0', substOutput->len - outputStart) != NULL) {
+			size_t kept = outputStart;
+			for (start = outputStart; start < substOutput->len; start++) {
+				if (substOutput->data[start] != '\0') {
+					substOutput->data[kept++] = substOutput->data[start];
+				}
+			}
+			substOutput->len = kept;
+		}
+		hasWords |= strspn(substOutput->data + outputStart, " \t\n") < substOutput->len - outputStart;
+		growBufReserve(substOutput, 1);
+		substOutput->data[substOutput->len++] = '\0';
+	}
+
+	// Replace the command line with the expanded one
+	growBufReserve(&result, 1);
+	result.data[result.len] = '\0';
+	free(commandLine);
+	*commandLinePtr = result.data;
+
+	return hasWords;
+}
+
+int sourceFile(char* path, struct bgPid* bgList, int* exitStatus, int* runSmallsh);
+
+/*
+* Run a processed command. Built-in commands are run by smallsh itself and anything else is run with otherCommand(). Takes in the command,
+* the list of background processes, and pointers to the exit status of the last foreground process and the variable that keeps smallsh
+* running. Returns the status to record in the history, which is -1 for jobs sent to the background.
+*/
+int runCommand(struct commandLine* currCommand, struct bgPid* head, int* exitStatus, int* runSmallsh) {
+
+	// If the user entered the 'exit' command, call the exitCheck function
+	if (strcmp(currCommand->command, "exit") == 0) {
+		*runSmallsh = exitCheck(head);
+	}
+
+	// If the user entered the 'cd' command, call the changeDir function
+	else if (strcmp(currCommand->command, "cd") == 0) {
+		changeDir(currCommand);
+	}
+
+	// If the user entered the 'status' command, call the checkStatus function
+	else if (strcmp(currCommand->command, "status") == 0) {
+		checkStatus(*exitStatus);
+	}
+
+	// If the user entered the 'history' command, call the showHistory function
+	else if (strcmp(currCommand->command, "history") == 0) {
+		showHistory(currCommand);
+	}
+
+	// If the user entered the 'source' command, call the sourceFile function
+	else if (strcmp(currCommand->command, "source") == 0) {
+		if (currCommand->arguments[0] == NULL) {
+			printf("usage: source FILE\n");
+			fflush(stdout);
+		}
+		else {
+			sourceFile(currCommand->arguments[0], head, exitStatus, runSmallsh);
+		}
+	}
+
+	// Otherwise use fork(), exec(), and waitpid() to execute other commands
+	else {
+		int childStatus = otherCommand(currCommand, head);
+
+		// Jobs sent to the background have no exit status yet, so the status of the last foreground process is kept
+		if (currCommand->background == 1 && fgOnly == 0) {
+			return -1;
+		}
+		*exitStatus = childStatus;
+		return childStatus;
+	}
+
+	return 0;
+}
+
+/*
+* Expand, process and run one line of a script. Takes in a pointer to the line, which may be replaced during expansion, the list of background
+* processes, and pointers to the exit status of the last foreground process and the variable that keeps smallsh running.
+*/
+void runLine(char** commandLine, struct bgPid* head, int* exitStatus, int* runSmallsh) {
+
+	struct growBuf substOutput = { NULL, 0, 0 };
+
+	varExpansion(commandLine);
+
+	if (cmdSubstitution(commandLine, *exitStatus, &substOutput, head) == 1) {
+		struct commandLine* currCommand = processComm(*commandLine, &substOutput);
+		runCommand(currCommand, head, exitStatus, runSmallsh);
+		freeCurrCommand(currCommand);
+	}
+
+	free(substOutput.data);
+}
+
+/*
+* Make sure a line read from a script ends with a newline, the way promptUser() leaves the lines it reads, since the last line of a file may
+* not have one. Takes in the line and its buffer size as set by getline() and the length of the line.
+*/
+void endLine(char** line, size_t* lineSize, ssize_t lineLen) {
+
+	if (lineLen > 0 && (*line)[lineLen - 1] == '\n') {
+		return;
+	}
+
+	if (lineLen + 2 > *lineSize) {
+		*lineSize = lineLen + 2;
+		*line = realloc(*line, *lineSize);
+	}
+	(*line)[lineLen] = '\n';
+	(*line)[lineLen + 1] = '\0';
+}
+
+/*
+* Append a string to a parsed script as its length followed by its characters. NULL is stored with a length of UINT32_MAX. Takes in the
+* parsed script and the string.
+*/
+void scriptAppendString(struct growBuf* blob, char* text) {
+
+	uint32_t length = (text == NULL) ? UINT32_MAX : strlen(text);
+
+	growBufReserve(blob, sizeof(uint32_t) + (text == NULL ? 0 : length));
+	memcpy(blob->data + blob->len, &length, sizeof(uint32_t));
+	blob->len += sizeof(uint32_t);
+
+	if (text != NULL) {
+		memcpy(blob->data + blob->len, text, length);
+		blob->len += length;
+	}
+}
+
+/*
+* Append a number to a parsed script. Takes in the parsed script and the number.
+*/
+void scriptAppendInt(struct growBuf* blob, int32_t value) {
+	growBufReserve(blob, sizeof(int32_t));
+	memcpy(blob->data + blob->len, &value, sizeof(int32_t));
+	blob->len += sizeof(int32_t);
+}
+
+/*
+* Read a number from a parsed script. Takes in the reader and returns the number. Marks the reader as failed if the data runs out.
+*/
+int32_t scriptReadInt(struct scriptReader* reader) {
+
+	int32_t value = 0;
+
+	if (reader->pos + sizeof(int32_t) > reader->len) {
+		reader->failed = 1;
+		return 0;
+	}
+	memcpy(&value, reader->data + reader->pos, sizeof(int32_t));
+	reader->pos += sizeof(int32_t);
+
+	return value;
+}
+
+/*
+* Read a string from a parsed script. Takes in the reader and returns a newly allocated copy of the string, or NULL if it was stored as NULL.
+* Marks the reader as failed if the data runs out.
+*/
+char* scriptReadString(struct scriptReader* reader) {
+
+	uint32_t length = scriptReadInt(reader);
+
+	if (reader->failed == 1 || length == UINT32_MAX) {
+		return NULL;
+	}
+	if (reader->pos + length > reader->len) {
+		reader->failed = 1;
+		return NULL;
+	}
+
+	char* text = calloc(length + 1, sizeof(char));
+	memcpy(text, reader->data + reader->pos, length);
+	reader->pos += length;
+
+	return text;
+}
+
+/*
+* Check whether a line has a here-document ('<<' that is not part of '<<<'). Scripts with here-documents are not parsed ahead of time since
+* the lines that follow are data rather than commands. Takes in the line and returns 1 if it has a here-document and 0 otherwise.
+*/
+int hasHereDocument(char* commandLine) {
+
+	char* found = commandLine;
+
+	while ((found = strstr(found, "<<")) != NULL) {
+		if (found[2] != '<') {
+			return 1;
+		}
+		found += 3;
+	}
+
+	return 0;
+}
+
+/*
+* Parse a script into its compact form. Comments and blank lines are dropped, lines without any '$' are processed into commands, and lines
+* that need expanding each time they run are kept as they are. Takes in the open script, its resolved path and status, and the buffer to
+* build the parsed script in. Returns 1 on success or 0 if the script has a here-document and cannot be parsed ahead of time.
+*/
+int parseScript(FILE* script, char* realPath, struct stat* scriptStat, struct growBuf* blob) {
+
+	struct scriptHeader header = { CACHE_MAGIC, CACHE_VERSION, scriptStat->st_mtim.tv_sec, scriptStat->st_mtim.tv_nsec, scriptStat->st_size, strlen(realPath), 0 };
+	char* line = NULL;
+	size_t lineSize = 0;
+	ssize_t lineLen;
+	int i;
+
+	growBufReserve(blob, sizeof(header) + header.pathLength);
+	memcpy(blob->data, &header, sizeof(header));
+	memcpy(blob->data + sizeof(header), realPath, header.pathLength);
+	blob->len = sizeof(header) + header.pathLength;
+
+	while ((lineLen = getline(&line, &lineSize, script)) != -1) {
+		endLine(&line, &lineSize, lineLen);
+
+		if (hasCommand(line) == 0) {
+			continue;
+		}
 
-		// If the end of the list is found without finding any empty nodes, create a new node for the child pid
-		if (bgList->next == NULL) {
-			struct bgPid* currChild = malloc(sizeof(struct bgPid));
+		if (hasHereDocument(line) == 1) {
+			free(line);
+			return 0;
+		}
 
-			currChild->backgroundPid = spawnpid;
-			currChild->next = NULL;
-			bgList->next = currChild;
-			return;
+		// Lines with '$$' or '$(...)' have to be expanded each time they are run
+		if (strchr(line, '$') != NULL) {
+			scriptAppendInt(blob, 0);
+			scriptAppendString(blob, line);
+			continue;
 		}
 
-		bgList = bgList->next;
+		// Everything else is processed now and stored as its words, redirections and background flag
+		struct commandLine* currCommand = processComm(line, NULL);
+
+		scriptAppendInt(blob, 1);
+		scriptAppendInt(blob, currCommand->background);
+		scriptAppendInt(blob, currCommand->numArgs);
+		for (i = 0; i < currCommand->numArgs; i++) {
+			scriptAppendString(blob, currCommand->extendArgs[i]);
+		}
+		scriptAppendInt(blob, currCommand->numRedirections);
+		for (i = 0; i < currCommand->numRedirections; i++) {
+			scriptAppendInt(blob, currCommand->redirection[i].type);
+			scriptAppendInt(blob, currCommand->redirection[i].fd);
+			scriptAppendString(blob, currCommand->redirection[i].target);
+		}
+
+		freeCurrCommand(currCommand);
 	}
 
+	free(line);
+	return 1;
 }
 
 /*
-* Free the linked list of background child pids. Takes in the head of the linked list as an argument and frees each node of the list.
-* 
-* Citation: Adapted on 2/1/2022 from Canvas post from Professor Gambord:
-* https://edstem.org/us/courses/16718/discussion/1020375
+* Read the number of entries that follow in a parsed script. A count that is negative, or larger than the data left could hold, marks the
+* parsed script as damaged. Takes in the reader and the fewest bytes an entry can take. Returns the count, or 0 if it is damaged.
 */
-void freeBgPidList(struct bgPid* bgList) {
-	if (bgList != NULL) {
-		freeBgPidList(bgList->next);
-		free(bgList);
+int scriptReadCount(struct scriptReader* reader, size_t entrySize) {
+
+	int32_t count = scriptReadInt(reader);
+
+	if (reader->failed == 1 || count < 0 || (size_t)count > (reader->len - reader->pos) / entrySize) {
+		reader->failed = 1;
+		return 0;
 	}
+
+	return count;
 }
 
 /*
-* Free the current command line. Takes in the command line as an argument.
-* 
-* Citation: Adapted on 2/1/2022 from Canvas post from Professor Gambord:
-* https://edstem.org/us/courses/16718/discussion/1020375
+* Rebuild a command from its parsed form. Takes in the reader positioned after the command's kind. Returns the command, or NULL if the data is damaged.
 */
-void freeCurrCommand(struct commandLine* currCommand) {
-	if (currCommand != NULL) {
+struct commandLine* readScriptCommand(struct scriptReader* reader) {
 
-		int i;
+	struct commandLine* currCommand = newCommand();
+	char* word;
+	int count;
+	int i;
 
-		free(currCommand->command);
+	currCommand->background = scriptReadInt(reader);
 
-		// Iterate through the memory allocated for arguments and free memory used for any individual arguments
-		for (i = 0; i < MAXARG; i++) {
-			if (currCommand->arguments[i] != '\0') {
-				free(currCommand->arguments[i]);
-			}
+	// Each word takes at least its length
+	count = scriptReadCount(reader, sizeof(int32_t));
+	for (i = 0; i < count && reader->failed == 0; i++) {
+		word = scriptReadString(reader);
+		if (word == NULL) {
+			reader->failed = 1;
+			break;
+		}
+		if (i == 0) {
+			currCommand->command = word;
 		}
+		addArgument(currCommand, word);
+		if (i != 0) {
+			free(word);
+		}
+	}
 
-		// Iterate through the memory allocated for the extended arguments array and free memory used for any individual arguments
-		for (i = 0; i < MAXARG + 2; i++) {
-			if (currCommand->extendArgs[i] != '\0') {
-				free(currCommand->extendArgs[i]);
-			}
+	// Each redirection takes at least its type, fd and target length
+	count = scriptReadCount(reader, 3 * sizeof(int32_t));
+	if (reader->failed == 0 && count > 0) {
+		currCommand->redirection = calloc(count, sizeof(struct redirect));
+		if (currCommand->redirection == NULL) {
+			reader->failed = 1;
+		}
+	}
+	for (i = 0; i < count && reader->failed == 0; i++) {
+		currCommand->redirection[i].type = scriptReadInt(reader);
+		currCommand->redirection[i].fd = scriptReadInt(reader);
+		currCommand->redirection[i].target = scriptReadString(reader);
+		currCommand->numRedirections += 1;
+		if (currCommand->redirection[i].type < REDIR_INPUT || currCommand->redirection[i].type > REDIR_HERESTRING) {
+			reader->failed = 1;
 		}
+	}
 
-		// Iterate through the memory allocated for redirection and free memory used for any individual redirections
-		for (i = 0; i < 2; i++) {
-			if (currCommand->redirection[i] != '\0') {
-				free(currCommand->redirection[i]);
-			}
+	if (reader->failed == 1 || currCommand->command == NULL) {
+		if (currCommand->command == NULL) {
+			currCommand->command = calloc(1, sizeof(char));
 		}
-		
-		// Free the memory allocated for the entire commandLine struct
-		free(currCommand);
+		freeCurrCommand(currCommand);
+		return NULL;
 	}
+
+	return currCommand;
 }
 
 /*
-* Execute commands that are not built-in using fork(), exec() and waitpid(). Function takes in a commandLine struct as
-* an argument.
-* 
-* Citation 1: Adapted from Module 4 - Processes; Exploration: Process API - Executing a New Program.
-*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-process-api-executing-a-new-program?module_item_id=21835974
-* Citation 2: Default action adapted from Module 4 - Processes; Exploration: Process API - Monitoring Child Processes
-*     https://canvas.oregonstate.edu/courses/1884946/pages/exploration-process-api-monitoring-child-processes?module_item_id=21835973
-* Citation 3: sigprocmask technique adapted on 2/1/222 from: Kerrisk, Michael. Chapter 20. The Linux Programming Interface a Linux Und UNIX System Programming Handbook,
-*     No Starch Press, San Francisco, CA, 2018, p. 410-411.
+* Check that a parsed script is intact and belongs to the current version of a script. Takes in the parsed script, the script's resolved path
+* and status. Returns 1 if the parsed script can be used and 0 if it is stale or damaged.
 */
-int otherCommand(struct commandLine* currCommand, struct bgPid* bgList) {
+int scriptIsCurrent(struct growBuf* blob, char* realPath, struct stat* scriptStat) {
 
-	sigset_t blockSIGTSTP;
-	sigset_t prevMask;
-	
-	// Have the child process ignore SIGTSTP if not in foreground-only mode
-	if (fgOnly == 1) {
-		sigemptyset(&blockSIGTSTP);
-		sigaddset(&blockSIGTSTP, SIGTSTP);
+	struct scriptHeader header;
 
-		sigprocmask(SIG_BLOCK, &blockSIGTSTP, &prevMask);
+	if (blob->len < sizeof(header)) {
+		return 0;
 	}
-	
-	// Create a holder for the head of the linked list. Used for resetting pointer to beginning of the list
-	struct bgPid* head = bgList;
-	
-	// Create variables for holding the child status for use during waitpid()
-	int childStatus;
-	int bgChildStatus;
+	memcpy(&header, blob->data, sizeof(header));
 
-	// Initialize spawnpid with an arbitrary id
-	pid_t spawnpid = -5;
+	return header.magic == CACHE_MAGIC && header.version == CACHE_VERSION
+		&& header.mtimeSec == scriptStat->st_mtim.tv_sec && header.mtimeNsec == scriptStat->st_mtim.tv_nsec
+		&& header.size == scriptStat->st_size && header.pathLength == strlen(realPath)
+		&& blob->len >= sizeof(header) + header.pathLength
+		&& memcmp(blob->data + sizeof(header), realPath, header.pathLength) == 0;
+}
 
-	int childDone;
+/*
+* Check that every line and command in a parsed script can be read back, so a damaged cache file is treated as stale instead of stopping the
+* script partway through. Takes in the parsed script. Returns 1 if it is intact and 0 if it is damaged.
+*/
+int scriptIsIntact(struct growBuf* blob) {
 
-	// fork() a new child process
-	spawnpid = fork();
+	struct scriptHeader header;
+	memcpy(&header, blob->data, sizeof(header));
 
-	switch (spawnpid) {
+	struct scriptReader reader = { blob->data, blob->len, sizeof(header) + header.pathLength, 0 };
+	struct commandLine* currCommand;
+	char* line;
 
-		// If fork() fails, set the exit status to -1
-	case -1:
-		perror("fork()\n");
-		childStatus = -1;
-		exit(-1);
-		break;
+	// Anything runScript() would stop at counts as damage
+	while (reader.pos < reader.len && reader.failed == 0) {
+		if (scriptReadInt(&reader) == 0) {
+			line = scriptReadString(&reader);
+			reader.failed |= line == NULL;
+			free(line);
+		}
+		else {
+			currCommand = readScriptCommand(&reader);
+			reader.failed |= currCommand == NULL;
+			freeCurrCommand(currCommand);
+		}
+	}
 
-		// If the fork succeeds, execute the command in the child process
-	case 0:
+	return reader.failed == 0;
+}
 
-		// Allow SIGINT to terminate process if it is running in the foreground
-		if (currCommand->background == 0) {
-			changeSIGINT();
-		}
+/*
+* Run the commands in a parsed script until they run out or one of them exits smallsh. Takes in the parsed script, the list of background
+* processes, and pointers to the exit status of the last foreground process and the variable that keeps smallsh running.
+*/
+void runScript(struct growBuf* blob, struct bgPid* head, int* exitStatus, int* runSmallsh) {
 
-		if (fgOnly == 0) {
-			initSIGTSTP();
-		}
+	struct scriptHeader header;
+	memcpy(&header, blob->data, sizeof(header));
+
+	struct scriptReader reader = { blob->data, blob->len, sizeof(header) + header.pathLength, 0 };
+	struct commandLine* currCommand;
+	char* line;
 
-		// Check to see if the process should be run in the background
-		if (currCommand->background == 1) {
-			bgRedirect(currCommand);
+	while (reader.pos < reader.len && *runSmallsh == -5) {
+
+		// Raw lines go through the usual expansion and processing
+		if (scriptReadInt(&reader) == 0) {
+			line = scriptReadString(&reader);
+			if (line == NULL) {
+				break;
+			}
+			runLine(&line, head, exitStatus, runSmallsh);
+			free(line);
 		}
 
-		// Check for redirection
-		if (currCommand->redirection[0] != NULL) {
-			procRedirect(currCommand, 0);
+		// Parsed commands are run directly
+		else {
+			currCommand = readScriptCommand(&reader);
+			if (currCommand == NULL) {
+				break;
+			}
+			runCommand(currCommand, head, exitStatus, runSmallsh);
+			freeCurrCommand(currCommand);
 		}
+	}
+}
+
+/*
+* Get the path of the file in the cache directory that holds a script's parsed form. The cache directory is $XDG_CACHE_HOME/smallsh, or
+* ~/.cache/smallsh, and the file is named after a hash of the script's path. Takes in the resolved path and whether the directory should be
+* created. Returns a newly allocated path, or NULL if there is no cache directory.
+*/
+char* cachePath(char* realPath, int create) {
 
-		// Check for a second redirection
-		if (currCommand->redirection[1] != NULL) {
-			procRedirect(currCommand, 1);
+	char* base = getenv("XDG_CACHE_HOME");
+	char* home = getenv("HOME");
+	char* cacheDir;
+	uint64_t hash = 14695981039346656037ULL;
+	int i;
+
+	if (base != NULL) {
+		cacheDir = calloc(strlen(base) + 10, sizeof(char));
+		strcpy(cacheDir, base);
+	}
+	else if (home != NULL) {
+		cacheDir = calloc(strlen(home) + 17, sizeof(char));
+		sprintf(cacheDir, "%s/.cache", home);
+	}
+	else {
+		return NULL;
+	}
+
+	// Create the base directory, and any missing directories above it, before the smallsh directory inside it
+	if (create == 1) {
+		for (i = 1; cacheDir[i] != '\0'; i++) {
+			if (cacheDir[i] == '/') {
+				cacheDir[i] = '\0';
+				mkdir(cacheDir, 0700);
+				cacheDir[i] = '/';
+			}
 		}
+		mkdir(cacheDir, 0700);
+	}
+	strcat(cacheDir, "/smallsh");
 
-		// Replace the current program with the command program
-		execvp(currCommand->command, currCommand->extendArgs);
+	if (create == 1) {
+		mkdir(cacheDir, 0700);
+	}
 
-		// execvp only returns if there's an error
-		printf("%s: no such file or directory\n", currCommand->command);
-		childStatus = 1;
-		exit(1);
-		break;
+	// FNV-1a hash of the path
+	for (i = 0; realPath[i] != '\0'; i++) {
+		hash = (hash ^ (unsigned char)realPath[i]) * 1099511628211ULL;
+	}
 
-		// Have the parent process wait for the child process to complete
-	default:
+	char* path = calloc(strlen(cacheDir) + 24, sizeof(char));
+	sprintf(path, "%s/%016llx", cacheDir, (unsigned long long)hash);
+	free(cacheDir);
 
-		// Reset pointer to the head of the linked list
-		bgList = head;
+	return path;
+}
 
-		// Check the pids running in the background to see if any have completed
-		while (bgList != NULL) {
+/*
+* Write a parsed script to the cache directory. It is written to a temporary file and renamed into place so another smallsh never reads a
+* partly written cache. Takes in the parsed script and the script's resolved path.
+*/
+void saveScriptCache(struct growBuf* blob, char* realPath) {
 
-			// If the node holds a pid, check it to see if the job has finished and clean up
-			if (bgList->backgroundPid != '\0') {
-				childDone = waitpid(bgList->backgroundPid, &bgChildStatus, WNOHANG);
+	char* path = cachePath(realPath, 1);
+	if (path == NULL) {
+		return;
+	}
 
-				// If the child pid has finished, print message and remove it from linked list
-				if (childDone != 0) {
-					printf("background pid %d is done: ", bgList->backgroundPid);
-					checkStatus(bgChildStatus);
-					bgList->backgroundPid = '\0';
-				}
-			}
+	char* tempPath = calloc(strlen(path) + 16, sizeof(char));
+	sprintf(tempPath, "%s.%d", path, getpid());
 
-			bgList = bgList->next;
+	int cacheFd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (cacheFd != -1) {
+		if (write(cacheFd, blob->data, blob->len) == blob->len) {
+			rename(tempPath, path);
+		}
+		else {
+			unlink(tempPath);
 		}
+		close(cacheFd);
+	}
 
-		// Reset pointer to the head of the linked list
-		bgList = head;
+	free(tempPath);
+	free(path);
+}
 
-		// Check if the current command should be run in the background and that the process is NOT in foreground-only mode
-		if (currCommand->background == 1 && fgOnly == 0) {
+/*
+* Drop a reference to a parsed script, freeing it once nothing uses it. Takes in the parsed script.
+*/
+void releaseScriptBlob(struct scriptBlob* blob) {
 
+	if (blob != NULL && --blob->refs == 0) {
+		free(blob->buf.data);
+		free(blob);
+	}
+}
 
-			// If it should, print message and run waitpid with WNOHANG so the process can run in the background
-			printf("background pid is %d\n", spawnpid);
-			fflush(stdout);
-			childDone = waitpid(spawnpid, &bgChildStatus, WNOHANG);
+/*
+* Put a parsed script in the in-memory cache, replacing any older one for the same path. Takes in the script's resolved path and the parsed
+* script, which the cache takes over. Returns the parsed script with a reference held for the caller.
+*/
+struct scriptBlob* replaceScriptCache(char* realPath, struct growBuf* buf) {
 
-			// If the child pid has finished, print message and remove it from linked list
-			if (childDone != 0) {
-				printf("background pid %d is done: ", spawnpid);
-				checkStatus(bgChildStatus);
-			}
-			else {
-				// Otherwise, add the child pid to the list of jobs running in the background
-				addToBgList(spawnpid, bgList);
-			}
+	struct scriptCache* cache;
+
+	for (cache = scriptCaches; cache != NULL; cache = cache->next) {
+		if (strcmp(cache->path, realPath) == 0) {
+			break;
 		}
+	}
 
-		// If the process should be run in the foreground or if process IS in foreground-only mode, wait to prompt user until process is complete
-		if (currCommand->background == 0 || fgOnly == 1) {
+	if (cache == NULL) {
+		cache = calloc(1, sizeof(struct scriptCache));
+		cache->path = calloc(strlen(realPath) + 1, sizeof(char));
+		strcpy(cache->path, realPath);
+		cache->next = scriptCaches;
+		scriptCaches = cache;
+	}
 
-			waitpid(spawnpid, &childStatus, 0);
+	// The older copy is only freed here if no run of it is in progress
+	releaseScriptBlob(cache->blob);
+	cache->blob = malloc(sizeof(struct scriptBlob));
+	cache->blob->buf = *buf;
+	cache->blob->refs = 2;
 
-			// Check to see if the process was terminated by SIGINT. 
-			if (childStatus == 2) {
+	return cache->blob;
+}
 
-				// If it was, print message
-				printf("terminated by signal %d\n", childStatus);
-				fflush(stdout);
+/*
+* Find the parsed form of a script, first among the scripts already parsed this session, then in the cache directory. Takes in the script's
+* resolved path and status. Returns the parsed script with a reference held for the caller, or NULL if there is no current one.
+*/
+struct scriptBlob* findScriptCache(char* realPath, struct stat* scriptStat) {
+
+	struct scriptCache* cache;
+
+	for (cache = scriptCaches; cache != NULL; cache = cache->next) {
+		if (strcmp(cache->path, realPath) == 0) {
+			break;
+		}
+	}
+
+	if (cache != NULL && scriptIsCurrent(&cache->blob->buf, realPath, scriptStat) == 1) {
+		cache->blob->refs++;
+		return cache->blob;
+	}
+
+	// Load the cache file, keeping it in memory for next time
+	char* path = cachePath(realPath, 0);
+	if (path == NULL) {
+		return NULL;
+	}
+	int cacheFd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (cacheFd == -1) {
+		return NULL;
+	}
+
+	struct growBuf blob = { NULL, 0, 0 };
+	readAllFd(cacheFd, &blob);
+	close(cacheFd);
+
+	if (scriptIsCurrent(&blob, realPath, scriptStat) == 0 || scriptIsIntact(&blob) == 0) {
+		free(blob.data);
+		return NULL;
+	}
+
+	return replaceScriptCache(realPath, &blob);
+}
+
+/*
+* Keep a newly parsed script in memory and in the cache directory. Takes in the parsed script, which the cache takes over, and the script's
+* resolved path. Returns the cached copy with a reference held for the caller.
+*/
+struct scriptBlob* storeScriptCache(struct growBuf* blob, char* realPath) {
+
+	struct scriptBlob* cached = replaceScriptCache(realPath, blob);
+
+	saveScriptCache(&cached->buf, realPath);
+
+	return cached;
+}
+
+/*
+* The source built-in. Runs the commands in a file in the current shell. The parsed form of each script is cached by path and modification
+* time, in memory and in the cache directory, so sourcing an unchanged script (including ~/.smallshrc at startup) skips reading and parsing
+* it. Scripts with here-documents are read and run line by line instead. Takes in the path of the script, the list of background processes,
+* and pointers to the exit status of the last foreground process and the variable that keeps smallsh running. Returns 0 on success and -1
+* if the script cannot be read.
+*/
+int sourceFile(char* path, struct bgPid* head, int* exitStatus, int* runSmallsh) {
+
+	static int sourceDepth = 0;
+	struct stat scriptStat;
+	struct scriptBlob* cached;
+	struct growBuf blob = { NULL, 0, 0 };
+
+	char* realPath = realpath(path, NULL);
+	if (realPath == NULL || stat(realPath, &scriptStat) == -1) {
+		printf("source: cannot open %s\n", path);
+		fflush(stdout);
+		free(realPath);
+		return -1;
+	}
+
+	if (sourceDepth >= MAXSOURCEDEPTH) {
+		printf("source: %s: too many nested scripts\n", path);
+		fflush(stdout);
+		free(realPath);
+		return -1;
+	}
+	sourceDepth++;
+
+	cached = findScriptCache(realPath, &scriptStat);
+
+	if (cached == NULL) {
+		// Keep the script out of the low file descriptors that the commands in it can name
+		int scriptFd = moveFdHigh(open(realPath, O_RDONLY | O_CLOEXEC));
+		FILE* script = (scriptFd != -1) ? fdopen(scriptFd, "r") : NULL;
+		if (script == NULL) {
+			if (scriptFd != -1) {
+				close(scriptFd);
 			}
+			printf("source: cannot open %s\n", path);
+			fflush(stdout);
+			free(realPath);
+			sourceDepth--;
+			return -1;
+		}
 
-			if (fgOnly == 1) {
-				sigprocmask(SIG_SETMASK, &prevMask, NULL);
+		if (parseScript(script, realPath, &scriptStat, &blob) == 1) {
+			cached = storeScriptCache(&blob, realPath);
+		}
+
+		// Scripts that cannot be parsed ahead of time are run a line at a time, with here-documents reading from the script
+		else {
+			free(blob.data);
+
+			FILE* prevInput = scriptInput;
+			char* line = NULL;
+			size_t lineSize = 0;
+			ssize_t lineLen;
+
+			rewind(script);
+			scriptInput = script;
+			while (*runSmallsh == -5 && (lineLen = getline(&line, &lineSize, script)) != -1) {
+				endLine(&line, &lineSize, lineLen);
+				if (hasCommand(line) == 1) {
+					runLine(&line, head, exitStatus, runSmallsh);
+				}
+				free(line);
+				line = NULL;
+				lineSize = 0;
 			}
+			scriptInput = prevInput;
+			free(line);
 		}
+		fclose(script);
+	}
 
-		break;
+	if (cached != NULL) {
+		runScript(&cached->buf, head, exitStatus, runSmallsh);
+		releaseScriptBlob(cached);
 	}
 
-	// Return the child status so it can be used when checking the status
-	return childStatus;
+	free(realPath);
+	sourceDepth--;
+	return 0;
 }
 
 /*====================== main function =======================================================================================================================*/
 
 
 /*
-* Function to control the flow of the program. Initializes necessary variables and starts a loop to continue prompting the user for commands until an exit
-* command is recieved.
+* Function to control the flow of the program. Initializes necessary variables, sources ~/.smallshrc and starts a loop to continue prompting the user
+* for commands until an exit command is recieved. With --startup-bench, it reports the time taken to reach the first prompt and exits instead.
 */
-int main(void) {
+int main(int argc, char* argv[]) {
+
+	// Note when smallsh started so the time to the first prompt can be measured
+	struct timespec startupStart;
+	struct timespec startupEnd;
+	clock_gettime(CLOCK_MONOTONIC, &startupStart);
+
+	int startupBench = (argc > 1 && strcmp(argv[1], "--startup-bench") == 0);
 
 	// Ignore SIGINT signal. This will later be changed for child processes running in the foreground
 	initSIGINT();
@@ -801,15 +3342,47 @@ int main(void) {
 	// Variable for tracking whether a valis comman has been entered
 	int isCommand;
 
+	// Variables for recording each command in the history
+	char* historyText;
+	int historyStatus;
+	long long startTime;
+
+	// Buffer for the outputs of the command substitutions in each line. It is reused from one line to the next
+	struct growBuf substOutput = { NULL, 0, 0 };
+
+	// Open the history file so every command can be recorded
+	historyOpen();
+
 	// Initialize the linked list that will be used for storing pids running in the background
 	struct bgPid* head = malloc(sizeof(struct bgPid));
 	head->backgroundPid = '\0';
+	head->timerFd = -1;
+	head->timedOut = 0;
 	head->next = NULL;
 
+	// Run the startup file, if there is one
+	if (getenv("HOME") != NULL) {
+		char* rcPath = calloc(strlen(getenv("HOME")) + strlen(RCFILE) + 2, sizeof(char));
+		sprintf(rcPath, "%s/%s", getenv("HOME"), RCFILE);
+		if (access(rcPath, R_OK) == 0) {
+			sourceFile(rcPath, head, &exitStatus, &runSmallsh);
+		}
+		free(rcPath);
+	}
+
+	// Report the time taken to reach the first prompt and exit
+	if (startupBench == 1) {
+		clock_gettime(CLOCK_MONOTONIC, &startupEnd);
+		printf("startup: %.3f ms to first prompt\n",
+			(startupEnd.tv_sec - startupStart.tv_sec) * 1000.0 + (startupEnd.tv_nsec - startupStart.tv_nsec) / 1000000.0);
+		fflush(stdout);
+		runSmallsh = exitCheck(head);
+	}
+
 	while (runSmallsh == -5){
 
-		// Give commandLine a size of MAXCOMM. This makes the program easy to update if MAXCOMM ever needs to change
-		char* commandLine = malloc(sizeof(char) * MAXCOMM);
+		// commandLine is allocated by promptUser() at whatever size the user's input needs
+		char* commandLine;
 
 		// Set SIGTSTP to enter/exit foreground-only mode
 		changeSIGTSTP();
@@ -817,45 +3390,47 @@ int main(void) {
 		isCommand = 0;
 
 		// Prompt the user for command
-		isCommand = promptUser(commandLine);
+		isCommand = promptUser(&commandLine, head);
+
+		// Save the command as it was entered so it can be added to the history once it has run
+		historyText = NULL;
+		if (isCommand == 1) {
+			historyText = calloc(strlen(commandLine) + 1, sizeof(char));
+			strcpy(historyText, commandLine);
+		}
+		startTime = monotonicMs();
 
 		// Perform any necessary expansions
-		varExpansion(commandLine);
+		varExpansion(&commandLine);
 
-		// If a command was entered, process it
+		// Run any command substitutions. Their outputs are split into words when the line is processed
+		substOutput.len = 0;
 		if (isCommand == 1) {
-			struct commandLine* currCommand = processComm(commandLine);
+			isCommand = cmdSubstitution(&commandLine, exitStatus, &substOutput, head);
+		}
 
-			// If the user entered the 'exit' command, call the exitCheck function
-			if (strcmp(currCommand->command, "exit") == 0) {
-				runSmallsh = exitCheck(head);
-			}
+		// If a command was entered, process it
+		if (isCommand == 1) {
+			struct commandLine* currCommand = processComm(commandLine, &substOutput);
 
-			// If the user entered the 'cd' command, call the changeDir function
-			else if (strcmp(currCommand->command, "cd") == 0) {
-				changeDir(currCommand);
-			}
+			// Run the command, whether it is built-in or not
+			historyStatus = runCommand(currCommand, head, &exitStatus, &runSmallsh);
 
-			// If the user entered the 'status' command, call the checkStatus function
-			else if (strcmp(currCommand->command, "status") == 0) {
-				checkStatus(exitStatus);
-			}
-			// Otherwise use fork(), exec(), and waitpid() to execute other commands
-			else {
-				exitStatus = otherCommand(currCommand, head);
-			}
+			historyAppend(historyText, historyStatus, monotonicMs() - startTime);
 
 			// Free the memory allocated for the command
 			freeCurrCommand(currCommand);
 
 		}
 
+		free(historyText);
 		free(commandLine);
 
 	}
 
 	// Free the list of pids running in the background
 	freeBgPidList(head);
+	free(substOutput.data);
 	
 	return EXIT_SUCCESS;
 }
\ No newline at end of file